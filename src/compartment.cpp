@@ -4,8 +4,11 @@
 #include "stdafx.h"
 
 #include <algorithm>
+#include <cstddef>
+#include <map>
 
 #include "compartment.h"
+#include "reactiongroup.h"
 #include "simulation.h"
 
 #ifdef _WIN32
@@ -18,117 +21,305 @@ namespace sgns2
 // ---------------------------------------------------------------------------
 Compartment::Compartment( SimulationInstance *sim, uint initialChemicalCount )
 : MarkovUmbrellaReactionInstance<NullStoich>( sim->getSimEventQueue(), NullStoich() )
-, sim(sim), X(NULL), dependencies(NULL), chemicalCount(0), removedDepCount(0)
-, waitList( this )
+, sim(sim), X(NULL)
+#ifdef SGNS_COMPACT_POPULATIONS
+, wideX(NULL)
+#endif
+, dependencies(NULL), chemicalCount(0), destroying(false)
+, sharedDeps(NULL), sharedSlots(NULL), sharingDeps(false)
+, waitList(NULL), group(NULL)
 {
+	setKind( KIND_COMPARTMENT );
 	if( initialChemicalCount )
 		setChemicalCount( initialChemicalCount );
 }
 
 // ---------------------------------------------------------------------------
 Compartment::~Compartment() throw() {
+	delete group;
 	setChemicalCount(0); // Frees all memory used by the compartment
+	delete waitList;
+}
+
+// ---------------------------------------------------------------------------
+void Compartment::getPopulationLayout( size_t &arrayOffset, size_t &stride, size_t &popOffset, size_t &wideOffset ) throw() {
+	// Compartment is not standard-layout, so offsetof cannot be used on it.
+	// No object is accessed; only the address of the member is taken.
+	const Compartment *c = reinterpret_cast<const Compartment*>( sizeof(Compartment) );
+	arrayOffset = (size_t)(reinterpret_cast<const char*>( &c->X ) - reinterpret_cast<const char*>( c ));
+	stride = sizeof(*c->X);
+	popOffset = 0;
+#ifdef SGNS_COMPACT_POPULATIONS
+	wideOffset = (size_t)(reinterpret_cast<const char*>( &c->wideX ) - reinterpret_cast<const char*>( c ));
+#else
+	wideOffset = (size_t)-1;
+#endif
 }
 
+// ---------------------------------------------------------------------------
+void Compartment::addMemoryUsage( CompartmentMemory &mem ) const throw() {
+#ifdef SGNS_COMPACT_POPULATIONS
+	mem.populations += chemicalCount * (wideX ? sizeof( Population ) : sizeof( CompactPopulation ));
+#else
+	mem.populations += chemicalCount * sizeof( Population );
+#endif
+	mem.dependencies += newDeps.capacity() * sizeof( NewDependency );
+	if( dependencies ) {
+		mem.dependencies += chemicalCount * sizeof( DependencyList );
+		for( uint i = 0; i < chemicalCount; i++ )
+			mem.dependencies += dependencies[i].capacity * sizeof( ReactionInstance* );
+	}
+	mem.queues += getHeapMemory();
+	if( waitList )
+		mem.waitLists += waitList->getMemoryUsage();
+}
+
+#ifdef SGNS_COMPACT_POPULATIONS
+// ---------------------------------------------------------------------------
+Population *Compartment::widen() {
+	wideX = new Population[chemicalCount];
+	for( uint i = 0; i < chemicalCount; i++ )
+		wideX[i] = X[i];
+	delete[] X;
+	X = NULL;
+	return wideX;
+}
+#endif
+
 // ---------------------------------------------------------------------------
 void Compartment::setChemicalCount( uint newCount ) {
 	// Changes the number of chemicals in the compartment
-	// Carries over the dependencies from the previous set of chemicals
-	// in the compartment
+	// Carries over the populations and dependencies of the previous set of
+	// chemicals in the compartment
 	// Destroys the dependencies for the chemical indices that are removed
 
-	if( chemicalCount ) {
-		if( newCount == 0 ) {
-			// Destroy the species
-			delete[] X;
-			delete[] dependencies;
-			newDeps.clear();
-		} else {
-			// Add extra species on the end
-			PopAndDepOffset *newX = new PopAndDepOffset[newCount];
-			uint i, n = std::min( chemicalCount, newCount );
-			for( i = 0; i < n; i++ ) {
-				newX[i].pop = X[i].pop;
-				newX[i].depEnd = X[i].depEnd;
-			}
-			for( ; i < newCount; i++ ) {
-				newX[i].pop = 0;
-				newX[i].depEnd = newX[i-1].depEnd;
-			}
+	if( sharedDeps && newCount )
+		unshareDependencies(); // The table is only valid for the type's count
+	sharedDeps = NULL;
+
+	uint i, n = std::min( chemicalCount, newCount );
+#ifdef SGNS_COMPACT_POPULATIONS
+	if( wideX ) {
+		Population *newWideX = NULL;
+		if( newCount ) {
+			newWideX = new Population[newCount];
+			for( i = 0; i < n; i++ )
+				newWideX[i] = wideX[i];
+			for( ; i < newCount; i++ )
+				newWideX[i] = 0;
 		}
-	} else if( newCount ) {
-		// Construct from nothing
-		X = new PopAndDepOffset[newCount];
-		dependencies = NULL;
-		for( uint i = 0; i < newCount; i++ ) {
-			X[i].pop = 0;
-			X[i].depEnd = 0;
+		delete[] wideX;
+		wideX = newWideX;
+	}
+	CompactPopulation *newX = NULL;
+	if( newCount && !wideX ) {
+		newX = new CompactPopulation[newCount];
+#else
+	Population *newX = NULL;
+	if( newCount ) {
+		newX = new Population[newCount];
+#endif
+		for( i = 0; i < n; i++ )
+			newX[i] = X[i];
+		for( ; i < newCount; i++ )
+			newX[i] = 0;
+	}
+	if( !newCount )
+		newDeps.clear();
+
+	if( dependencies ) {
+		for( i = n; i < chemicalCount; i++ )
+			delete[] dependencies[i].reactions;
+		DependencyList *newDependencies = NULL;
+		if( newCount ) {
+			newDependencies = new DependencyList[newCount];
+			std::copy( dependencies, dependencies + n, newDependencies );
+			for( i = n; i < newCount; i++ ) {
+				newDependencies[i].reactions = NULL;
+				newDependencies[i].count = 0;
+				newDependencies[i].capacity = 0;
+			}
 		}
+		delete[] dependencies;
+		dependencies = newDependencies;
 	}
+
+	delete[] X;
+	X = newX;
 	chemicalCount = newCount;
 }
 
+// ---------------------------------------------------------------------------
+void Compartment::allocateDependencies() {
+	dependencies = new DependencyList[chemicalCount];
+	for( uint i = 0; i < chemicalCount; i++ ) {
+		dependencies[i].reactions = NULL;
+		dependencies[i].count = 0;
+		dependencies[i].capacity = 0;
+	}
+}
+
 // ---------------------------------------------------------------------------
 void Compartment::removeDependency( uint index, ReactionInstance *reaction ) {
-	// Flags a dependency to be removed
-
-	uint i = 0;
-	if( index )
-		i = X[index-1].depEnd;
-	for( ; i < X[index].depEnd; i++ ) {
-		if( dependencies[i] == reaction ) {
-			dependencies[i] = NULL;
-			if( removedDepCount == 0 && newDeps.size() == 0 )
-				removedDepCount++;
+	if( destroying )
+		return;
+
+	// Search from the most recently added, keeping the others in order
+	if( dependencies ) {
+		DependencyList &deps = dependencies[index];
+		for( uint i = deps.count; i-- > 0; ) {
+			if( deps.reactions[i] == reaction ) {
+				std::copy( deps.reactions + i + 1, deps.reactions + deps.count, deps.reactions + i );
+				deps.count--;
+				return;
+			}
+		}
+	}
+
+	// Not yet in effect
+	for( size_t i = newDeps.size(); i-- > 0; ) {
+		if( newDeps[i].index == index && newDeps[i].reaction == reaction ) {
+			newDeps.erase( newDeps.begin() + i );
 			return;
 		}
 	}
+
+	// In the shared table, which the compartment no longer matches
+	if( sharedDeps ) {
+		unshareDependencies();
+		removeDependency( index, reaction );
+	}
 }
 
 // ---------------------------------------------------------------------------
 void Compartment::triggerUpdate( uint index ) {
 	// Call popUpdate for all reactions dependent on the given reactant
 
-	uint i = 0;
-	if( index )
-		i = X[index-1].depEnd;
-	uint last = X[index].depEnd;
-	for( ; i < last; i++ )
-		dependencies[i]->popUpdate(0);
+	if( sharedDeps ) {
+		const DependencyTable &table = *sharedDeps;
+		uint end = table.offsets[index + 1];
+		for( uint i = table.offsets[index]; i < end; i++ )
+			sharedSlots[table.slots[i]]->popUpdate( (uint)index );
+	}
+	if( dependencies ) {
+		const DependencyList &deps = dependencies[index];
+		for( uint i = 0; i < deps.count; i++ )
+			deps.reactions[i]->popUpdate( (uint)index );
+	}
 }
 
 // ---------------------------------------------------------------------------
 void Compartment::rebuildDependencies() {
-	// Regenerate the dependency list
-
-	if( chemicalCount == 0 )
-		return; // No chemicals.. no dependencies
+	// Append the new dependencies to the lists of their species
 
-	// Allocate the total amount of space required
-	size_t newDepCount = static_cast<uint>(X[chemicalCount-1].depEnd + newDeps.size() - removedDepCount);
-	ReactionInstance **newDepArray = new ReactionInstance*[newDepCount];
+	if( newDeps.empty() )
+		return;
+	if( !dependencies )
+		allocateDependencies();
 
-	// Sort by species index
+	// Sort by species index, which also fixes the order in which the
+	// reactions dependent on each species are updated
 	std::sort( newDeps.begin(), newDeps.end() );
 
-	uint destDep = 0, origDep = 0, newDepI = 0;
-	for( uint i = 0; i < chemicalCount; i++ ) {
-		// Copy over the old dependencies
-		while( origDep < X[i].depEnd ) {
-			if( dependencies[origDep] )
-				newDepArray[destDep++] = dependencies[origDep];
-			origDep++;
+	for( size_t i = 0; i < newDeps.size(); i++ ) {
+		DependencyList &deps = dependencies[newDeps[i].index];
+		if( deps.count == deps.capacity ) {
+			uint capacity = deps.capacity ? deps.capacity * 2 : 4;
+			ReactionInstance **reactions = new ReactionInstance*[capacity];
+			std::copy( deps.reactions, deps.reactions + deps.count, reactions );
+			delete[] deps.reactions;
+			deps.reactions = reactions;
+			deps.capacity = capacity;
 		}
-		// Put in new dependencies
-		while( newDepI < newDeps.size() && newDeps[newDepI].index == i )
-			newDepArray[destDep++] = newDeps[newDepI++].reaction;
-		X[i].depEnd = destDep;
+		deps.reactions[deps.count++] = newDeps[i].reaction;
 	}
+	newDeps.clear();
+}
+
+// ---------------------------------------------------------------------------
+bool Compartment::hasDependencies() const {
+	if( sharedDeps || !newDeps.empty() )
+		return true;
+	for( uint i = 0; dependencies && i < chemicalCount; i++ ) {
+		if( dependencies[i].count )
+			return true;
+	}
+	return false;
+}
+
+// ---------------------------------------------------------------------------
+bool Compartment::buildSharedDependencies( DependencyTable *table, ReactionInstance **slots, uint slotCount ) {
+	// Records the pending dependencies of a compartment that had no others
+	// before its bank was instantiated
+
+	assert( table->state == DependencyTable::UNBUILT && !sharedDeps );
+
+	std::map< ReactionInstance*, uint > slotOf;
+	for( uint i = 0; i < slotCount; i++ ) {
+		if( slots[i] )
+			slotOf[slots[i]] = i;
+	}
+	for( size_t i = 0; i < newDeps.size(); i++ ) {
+		if( slotOf.find( newDeps[i].reaction ) == slotOf.end() ) {
+			table->state = DependencyTable::UNSHAREABLE;
+			return false;
+		}
+	}
+
+	// Same order as rebuildDependencies() would give the compartment
+	std::sort( newDeps.begin(), newDeps.end() );
+
+	table->offsets.assign( chemicalCount + 1, 0 );
+	table->slots.resize( newDeps.size() );
+	for( size_t i = 0; i < newDeps.size(); i++ ) {
+		table->offsets[newDeps[i].index + 1]++;
+		table->slots[i] = slotOf[newDeps[i].reaction];
+	}
+	for( uint i = 0; i < chemicalCount; i++ )
+		table->offsets[i + 1] += table->offsets[i];
+	table->state = DependencyTable::BUILT;
 
-	delete[] dependencies;
-	dependencies = newDepArray;
-	removedDepCount = 0;
 	newDeps.clear();
+	sharedDeps = table;
+	sharedSlots = slots;
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+void Compartment::useSharedDependencies( const DependencyTable *table, ReactionInstance **slots ) {
+	assert( sharingDeps && table->state == DependencyTable::BUILT );
+	sharingDeps = false;
+	sharedDeps = table;
+	sharedSlots = slots;
+}
+
+// ---------------------------------------------------------------------------
+void Compartment::unshareDependencies() {
+	// The shared dependencies go before the compartment's own, which were
+	// added after them
+
+	const DependencyTable &table = *sharedDeps;
+	sharedDeps = NULL;
+	if( !dependencies )
+		allocateDependencies();
+
+	for( uint i = 0; i < chemicalCount; i++ ) {
+		DependencyList &deps = dependencies[i];
+		uint begin = table.offsets[i], shared = table.offsets[i + 1] - begin;
+		if( !shared )
+			continue;
+		uint capacity = std::max( deps.capacity, (uint)4 );
+		while( capacity < deps.count + shared )
+			capacity *= 2;
+		ReactionInstance **reactions = new ReactionInstance*[capacity];
+		for( uint j = 0; j < shared; j++ )
+			reactions[j] = sharedSlots[table.slots[begin + j]];
+		std::copy( deps.reactions, deps.reactions + deps.count, reactions + shared );
+		delete[] deps.reactions;
+		deps.reactions = reactions;
+		deps.count += shared;
+		deps.capacity = capacity;
+	}
 }
 
 }
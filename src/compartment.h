@@ -28,9 +28,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /* compartment.h/cpp
 
 Compartment class contents:
-	- Stores the populations of all chemical species contained within
+	- Stores the populations of all chemical species contained within, in
+	  32 bits until one outgrows them when built with compact populations
 	- Stores the reaction dependency graph
 	- Updates reactions dependent on chemicals whose population changes
+	- Owns the ReactionGroup simulating reactions handed to another engine
+
+DependencyTable class contents:
+	- Reaction dependency graph shared by the compartments of a type
+
+CompartmentMemory struct contents:
+	- Bytes held by a set of compartments, by what they are used for
 */
 
 #ifndef COMPARTMENT_H
@@ -51,7 +59,45 @@ namespace reaction {
 	class BankInstance;
 }
 class SimulationInstance;
+class ReactionGroup;
+
+// The reactions dependent on each species, as slots in an array of
+// ReactionInstances which each compartment fills in with its own
+class DependencyTable {
+public:
+	DependencyTable() : state(UNBUILT) { }
+
+	enum State {
+		UNBUILT, // Not yet recorded from a compartment
+		BUILT,
+		UNSHAREABLE // Some dependencies were not on slots
+	};
+	State state;
+	// Range of each species in slots, followed by the end of the last
+	std::vector< uint > offsets;
+	std::vector< uint > slots;
+};
 
+// Bytes held by a set of compartments, by what they are used for. Tables
+// shared between the compartments of a type are not counted.
+struct CompartmentMemory {
+	CompartmentMemory()
+		: count(0), objects(0), populations(0), dependencies(0)
+		, queues(0), waitLists(0), reactions(0) { }
+
+	inline size_t getTotal() const {
+		return objects + populations + dependencies + queues + waitLists + reactions; }
+
+	size_t count; // Number of compartments counted
+	size_t objects; // The compartment objects themselves
+	size_t populations;
+	size_t dependencies;
+	size_t queues; // Event queues which have outgrown the objects
+	size_t waitLists;
+	size_t reactions; // Instances of the compartments' reaction banks
+};
+
+// Tagged KIND_COMPARTMENT, so subclasses must not override trigger() or update()
 class Compartment : public MarkovUmbrellaReactionInstance<NullStoich> {
 public:
 	Compartment( SimulationInstance *inst, uint initialChemicalCount );
@@ -66,24 +112,47 @@ public:
 	// NOTE: rebuildDependencies() MUST be called after this function is called
 	// for the dependency to take effect for the next set/modifyPopulation.
 	inline void addDependency( uint index, ReactionInstance *reaction ) {
+		if( sharingDeps )
+			return; // Already in the shared table
 		NewDependency newDep;
 		newDep.index = index;
 		newDep.reaction = reaction;
 		newDeps.push_back( newDep );
 	}
-	// Remove a reaction dependency
-	// NOTE: rebuildDependencies() MUST be called after this function is called
-	// for the dependency to take effect for the next set/modifyPopulation.
+	// Remove a reaction dependency. Takes effect immediately, in time
+	// proportional to the number of reactions dependent on the species.
 	void removeDependency( uint index, ReactionInstance *reaction );
 
+#ifndef SGNS_COMPACT_POPULATIONS
 	// Access to the population of the chemical with the given index
-	inline Population getPopulation( uint index ) { return X[index].pop; }
+	inline Population getPopulation( uint index ) { return X[index]; }
 	// Directly set the population of a species
 	// Does not trigger popUpdate calls
-	inline void setPopulationNoUpdate( uint index, Population pop ) { X[index].pop = pop; }
+	inline void setPopulationNoUpdate( uint index, Population pop ) { X[index] = pop; }
 	// Directly modify the population of a species
 	// Does not trigger popUpdate calls
-	inline void modifyPopulationNoUpdate( uint index, Population popDelta ) { X[index].pop += popDelta; }
+	inline void modifyPopulationNoUpdate( uint index, Population popDelta ) { X[index] += popDelta; }
+#else
+	// Access to the population of the chemical with the given index
+	inline Population getPopulation( uint index ) { return wideX ? wideX[index] : X[index]; }
+	// Directly set the population of a species, switching the compartment
+	// to 64-bit populations if it does not fit in 32 bits
+	// Does not trigger popUpdate calls
+	inline void setPopulationNoUpdate( uint index, Population pop ) {
+		if( wideX )
+			wideX[index] = pop;
+		else if( pop == (CompactPopulation)pop )
+			X[index] = (CompactPopulation)pop;
+		else
+			widen()[index] = pop;
+	}
+	// Directly modify the population of a species
+	// Does not trigger popUpdate calls
+	inline void modifyPopulationNoUpdate( uint index, Population popDelta ) {
+		setPopulationNoUpdate( index, getPopulation( index ) + popDelta ); }
+	// Does the compartment store its populations in 64 bits?
+	inline bool hasWidePopulations() const { return wideX != NULL; }
+#endif
 
 	// Set the population of a species
 	// Calls popUpdate for all reactions dependent on this species
@@ -98,33 +167,77 @@ public:
 		triggerUpdate( index );
 	}
 
-	// Regenerate the dependency list
+	// Put the dependencies added since the last call into effect, in time
+	// proportional to their number
 	// Must be called before changing populations with update-full functions
 	void rebuildDependencies();
 
-	// Access to the compartment's wait list
-	inline WaitList *getWaitList() { return &waitList; }
+	// Does any reaction depend on the compartment's species, or is about to
+	bool hasDependencies() const;
+	// Record the pending dependencies of a compartment without others into
+	// the table, in terms of the given slots, and use it. Returns false,
+	// leaving the table UNSHAREABLE, if some are on other reactions.
+	bool buildSharedDependencies( DependencyTable *table, ReactionInstance **slots, uint slotCount );
+	// Ignore the dependencies added until useSharedDependencies(), which are
+	// those of a table built from another compartment of the same type
+	inline void beginSharedDependencies() { sharingDeps = true; }
+	// Use the built table for the dependencies on the reactions in slots
+	void useSharedDependencies( const DependencyTable *table, ReactionInstance **slots );
+
+	// Access to the compartment's wait list, which is created on the first
+	// call, so only compartments which receive delayed molecules hold one
+	inline WaitList *getWaitList() {
+		if( !waitList )
+			waitList = new WaitList( this );
+		return waitList;
+	}
+	// Number of molecules on the wait list
+	inline Population getWaitListSize() const { return waitList ? waitList->getSize() : 0; }
+
+	// Access to the group of reactions simulated by an engine other than the
+	// NRM. NULL until the first such reaction is instantiated in here.
+	// The compartment takes ownership of the group.
+	inline ReactionGroup *getReactionGroup() { return group; }
+	inline void setReactionGroup( ReactionGroup *g ) { group = g; }
 
 	// Access to the main simulation instance that this compartment is a part of
 	inline SimulationInstance *getSimulation() const { return sim; }
 
+	// Where the populations are, for natively compiled code: the offset of
+	// the pointer to the population array in a Compartment, and the stride
+	// and offset of the populations in that array, all in bytes. With
+	// compact populations, wideOffset is that of the pointer to the 64-bit
+	// array, which is used instead when it is not NULL, else (size_t)-1.
+	static void getPopulationLayout( size_t &arrayOffset, size_t &stride, size_t &popOffset, size_t &wideOffset ) throw();
+
+	// Add the bytes the compartment holds outside of its object to mem
+	void addMemoryUsage( CompartmentMemory &mem ) const throw();
+
 protected:
 	// Call popUpdate for all reactions dependent on the given reactant
+	// The species index is passed as popUpdate's cookie
 	void triggerUpdate( uint index );
 
 	SimulationInstance *sim; // Containing simulation
 
-	struct PopAndDepOffset {
-		Population pop; // Current Population of the chemical
-		uint depEnd; // Index of the last ReactionInstance dependent on
-		             // this chemical in the dependency list
+	// The reactions dependent on a chemical, in the order they were added
+	struct DependencyList {
+		ReactionInstance **reactions;
+		uint count;
+		uint capacity;
 	};
-	PopAndDepOffset *X; // Chemical populations and dependency indices
-	ReactionInstance **dependencies; // Reaction dependency list
+#ifndef SGNS_COMPACT_POPULATIONS
+	Population *X; // Chemical populations
+#else
+	CompactPopulation *X; // Chemical populations, while they fit
+	Population *wideX; // Chemical populations once one has outgrown X
+	// Move the populations to wideX, returning it
+	Population *widen();
+#endif
+	DependencyList *dependencies; // Reaction dependencies of each chemical
 	uint chemicalCount; // Number of chemicals in this compartment
 
 	// Temporary structure for new dependencies
-	// TODO: Remove this overhead from the dependency construction process
 	struct NewDependency {
 		uint index; // The chemical index
 		ReactionInstance *reaction; // The newly-dependent reaction
@@ -133,9 +246,22 @@ protected:
 		inline bool operator <( const NewDependency &rhs ) const { return index < rhs.index; }
 	};
 	std::vector< NewDependency > newDeps; // List of new dependencies
-	uint removedDepCount; // Number of dependencies to be removed
+	// Set while the compartment's reactions are destroyed along with it, so
+	// that they need not remove their dependencies one by one
+	bool destroying;
+
+	// Dependencies shared with the other compartments of the type, which
+	// are updated before those in the compartment's own lists (or NULL)
+	const DependencyTable *sharedDeps;
+	ReactionInstance **sharedSlots;
+	bool sharingDeps; // Between begin- and useSharedDependencies()
+	// Move the shared dependencies into the compartment's own lists
+	void unshareDependencies();
+	// Allocate the compartment's own lists
+	void allocateDependencies();
 
-	WaitList waitList; // The compartment's wait list
+	WaitList *waitList; // The compartment's wait list (or NULL)
+	ReactionGroup *group; // Reactions handed to another engine (or NULL)
 };
 
 }
@@ -6,6 +6,7 @@
 #include "compartmenttype.h"
 #include "reactionbank.h"
 #include "hiercompartment.h"
+#include "multithread.h"
 
 namespace sgns2 {
 
@@ -17,6 +18,7 @@ CompartmentType::CompartmentType( const char *name, CompartmentType *parentType
 , outputCompartment(true)
 {
 	reactions = new reaction::IntraBankTemplate;
+	dependencyMutex = mt::newMutex();
 }
 
 // ---------------------------------------------------------------------------
@@ -27,11 +29,13 @@ CompartmentType::CompartmentType( const std::string &name, CompartmentType *pare
 , outputCompartment(true)
 {
 	reactions = new reaction::IntraBankTemplate;
+	dependencyMutex = mt::newMutex();
 }
 
 // ---------------------------------------------------------------------------
 CompartmentType::~CompartmentType() {
 	delete reactions;
+	mt::deleteMutex( dependencyMutex );
 }
 
 // ---------------------------------------------------------------------------
@@ -52,8 +56,7 @@ HierCompartment *CompartmentType::instantiate( SimulationInstance *sim ) const {
 
 	HierCompartment *newInst = new HierCompartment( this, sim );
 	if( !superType ) {
-		newInst->mainBank = reactions->instantiate( newInst, NULL );
-		newInst->rebuildDependencies();
+		instantiateBank( newInst, NULL );
 	}
 
 	return newInst;
@@ -98,8 +101,39 @@ void CompartmentType::instantiateBankIn( HierCompartment *in ) const {
 		comp = comp->getContainer();
 	}
 
-	in->mainBank = reactions->instantiate( in, parentBanks );
-	in->rebuildDependencies();
+	instantiateBank( in, parentBanks );
+}
+
+// ---------------------------------------------------------------------------
+void CompartmentType::instantiateBank( HierCompartment *in, reaction::BankInstance **context ) const {
+	// Every compartment of the type adds the same dependencies in the same
+	// order, so those of the first can stand for the rest. Compartments
+	// that already have other dependencies keep all of theirs privately.
+
+	mt::lock( dependencyMutex );
+	DependencyTable::State state = dependencies.state;
+	mt::unlock( dependencyMutex );
+	if( state != DependencyTable::UNSHAREABLE && in->hasDependencies() )
+		state = DependencyTable::UNSHAREABLE;
+
+	if( state == DependencyTable::BUILT )
+		in->beginSharedDependencies();
+	in->mainBank = reactions->instantiate( in, context );
+	ReactionInstance **slots = in->mainBank->getReactionInstances();
+
+	if( state == DependencyTable::BUILT ) {
+		in->useSharedDependencies( &dependencies, slots );
+	} else {
+		bool shared = false;
+		if( state == DependencyTable::UNBUILT ) {
+			mt::lock( dependencyMutex );
+			if( dependencies.state == DependencyTable::UNBUILT )
+				shared = in->buildSharedDependencies( &dependencies, slots, reactions->getReactionCount() + 1 );
+			mt::unlock( dependencyMutex );
+		}
+		if( !shared )
+			in->rebuildDependencies();
+	}
 }
 
 } // namespace sgns2
@@ -32,6 +32,7 @@ CompartmentType class contents:
 	- Stores the type name and relation to parent types
 	- Stores the chemical types present in compartments of this type
 	- Stores whether the compartment type should be output
+	- Shares the reaction dependencies of its compartments between them
 */
 
 #ifndef COMPARTMENTTYPE_H
@@ -42,6 +43,7 @@ CompartmentType class contents:
 #include <map>
 
 #include "reactionbank.h"
+#include "compartment.h"
 
 namespace sgns2 {
 
@@ -98,6 +100,9 @@ public:
 private:
 	// Instantiates the reaction bank in the target compartment
 	void instantiateBankIn( HierCompartment *in ) const;
+	// Instantiates the bank under the given containers' banks, and puts its
+	// dependencies into effect through the shared table where possible
+	void instantiateBank( HierCompartment *in, reaction::BankInstance **context ) const;
 
 	std::string name; // Type name
 	uint depth; // Depth of the compartment type
@@ -108,6 +113,10 @@ private:
 	typedef std::map< Chemical*, uint > ChemicalMap;
 	ChemicalMap chemicalIndices; // Chemical -> index map
 	bool outputCompartment; // Should this compartment type be output?
+	// Dependencies of the bank, recorded from the first compartment
+	// instantiated. The batch threads share it, hence the mutex.
+	mutable DependencyTable dependencies;
+	void *dependencyMutex;
 };
 
 } // namespace sgns2
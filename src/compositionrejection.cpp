@@ -0,0 +1,205 @@
+// See compositionrejection.h for a description of the contents of this file.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "compositionrejection.h"
+
+namespace sgns2 {
+
+// ---------------------------------------------------------------------------
+CompositionRejectionGroup::CompositionRejectionGroup( Compartment *in ) throw()
+: ReactionGroup( in, reaction::Template::ENGINE_CR )
+, memberCount(0)
+, binBase(0)
+, incrementalUpdates(0)
+{
+}
+
+// ---------------------------------------------------------------------------
+CompositionRejectionGroup::~CompositionRejectionGroup() throw() {
+	assert( memberCount == 0 ); // All members must be destroyed first
+}
+
+// ---------------------------------------------------------------------------
+GroupMember *CompositionRejectionGroup::newMember( const reaction::Template *tmplate ) {
+	// Members depend on their reactants exactly as NRM reactions do
+	Member *member = new Member( this, tmplate );
+	tmplate->addDependencies( &compartment, member );
+	memberCount++;
+	return member;
+}
+
+// ---------------------------------------------------------------------------
+void CompositionRejectionGroup::removeMember( GroupMember *member ) throw() {
+	Member *m = static_cast<Member*>(member);
+	m->getTemplate()->removeDependencies( &compartment, m );
+	removeFromBin( m );
+	if( m->touched )
+		touchedList.erase( std::find( touchedList.begin(), touchedList.end(), m ) );
+	memberCount--;
+
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void CompositionRejectionGroup::touch( GroupMember *member ) throw() {
+	Member *m = static_cast<Member*>(member);
+	if( !m->touched ) {
+		m->touched = true;
+		touchedList.push_back( m );
+	}
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void CompositionRejectionGroup::trigger() throw() {
+	// Fire a member chosen in proportion to its propensity
+
+	double t = getQueue()->getBaseTime();
+	RNG::RNG *rng = getRNG();
+	// The members touched by the reaction are recalculated right here
+	bool wasScheduled = updSelf;
+	updSelf = true;
+
+	// Composition: choose a bin in proportion to its total propensity
+	// Searching from the top usually ends in the first few bins
+	double r = rng->rand_halfclosed01() * sumBins();
+	Bin *bin = NULL;
+	int exponent = 0;
+	for( int i = (int)bins.size() - 1; i >= 0; i-- ) {
+		if( bins[i].members.empty() )
+			continue;
+		bin = &bins[i];
+		exponent = binBase + i;
+		r -= bin->sum;
+		if( r < 0.0 )
+			break;
+	}
+
+	if( bin ) {
+		// Rejection: every member of the bin has 2^(e-1) < a <= 2^e, so a
+		// uniformly chosen member is accepted with probability > 1/2
+		double bound = ldexp( 1.0, exponent );
+		RNG::ulong n = (RNG::ulong)bin->members.size() - 1;
+		const BinEntry *chosen;
+		do {
+			chosen = &bin->members[rng->rand_int( n )];
+		} while( rng->rand_halfclosed01() * bound >= chosen->a );
+
+		chosen->member->getTemplate()->execute( &compartment );
+	}
+
+	flushTouched();
+	reschedule( t, sumBins(), true );
+	updSelf = wasScheduled;
+}
+
+// ---------------------------------------------------------------------------
+void CompositionRejectionGroup::update() throw() {
+	updSelf = false;
+	flushTouched();
+	reschedule( getQueue()->getUpdatedBaseTime(), sumBins(), false );
+}
+
+// ---------------------------------------------------------------------------
+void CompositionRejectionGroup::flushTouched() throw() {
+	for( size_t i = 0; i < touchedList.size(); i++ ) {
+		Member *m = touchedList[i];
+		m->touched = false;
+		setPropensity( m, m->c * m->getTemplate()->calcH( &compartment ) );
+	}
+	touchedList.clear();
+}
+
+// ---------------------------------------------------------------------------
+void CompositionRejectionGroup::setPropensity( Member *m, double a ) throw() {
+	// Moves a member to the bin matching its new propensity
+
+	if( !(a > 0.0) ) {
+		removeFromBin( m );
+		return;
+	}
+	if( a > DBL_MAX )
+		a = DBL_MAX;
+
+	// Exact powers of two go to the bin below, where they are always accepted
+	int exponent;
+	if( frexp( a, &exponent ) == 0.5 )
+		exponent--;
+	if( exponent == m->bin ) {
+		// Same bin
+		Bin &b = bins[exponent - binBase];
+		b.sum += a - m->a;
+		b.members[m->getSlot()].a = a;
+		m->a = a;
+		incrementalUpdates++;
+		return;
+	}
+
+	removeFromBin( m );
+	if( bins.empty() ) {
+		binBase = exponent;
+		bins.resize( 1 );
+	} else if( exponent < binBase ) {
+		bins.insert( bins.begin(), binBase - exponent, Bin() );
+		binBase = exponent;
+	} else if( exponent - binBase >= (int)bins.size() ) {
+		bins.resize( exponent - binBase + 1 );
+	}
+
+	Bin &b = bins[exponent - binBase];
+	BinEntry be = { a, m };
+	m->a = a;
+	m->bin = exponent;
+	m->setSlot( (uint)b.members.size() );
+	b.members.push_back( be );
+	b.sum += a;
+	incrementalUpdates++;
+}
+
+// ---------------------------------------------------------------------------
+void CompositionRejectionGroup::removeFromBin( Member *m ) throw() {
+	// Swaps the last member of the bin into the removed member's place
+
+	if( m->bin == NO_BIN )
+		return;
+
+	Bin &b = bins[m->bin - binBase];
+	const BinEntry &last = b.members.back();
+	last.member->setSlot( m->getSlot() );
+	b.members[m->getSlot()] = last;
+	b.members.pop_back();
+	if( b.members.empty() )
+		b.sum = 0.0; // Drop any accumulated rounding error
+	else
+		b.sum -= m->a;
+
+	m->a = 0.0;
+	m->bin = NO_BIN;
+	incrementalUpdates++;
+}
+
+// ---------------------------------------------------------------------------
+double CompositionRejectionGroup::sumBins() throw() {
+	// Resumming after as many updates as there are members keeps the cost
+	// constant per update
+	if( incrementalUpdates > memberCount + 1024 ) {
+		for( size_t i = 0; i < bins.size(); i++ ) {
+			Bin &b = bins[i];
+			b.sum = 0.0;
+			for( size_t j = 0; j < b.members.size(); j++ )
+				b.sum += b.members[j].a;
+		}
+		incrementalUpdates = 0;
+	}
+
+	double sum = 0.0;
+	for( size_t i = 0; i < bins.size(); i++ )
+		sum += bins[i].sum;
+	return sum;
+}
+
+} // namespace sgns2
@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2011, Jason Lloyd-Price, Abhishekh Gupta, and Andre S. Ribeiro
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of the contributors may not be used to endorse or promote
+	  products derived from this software without specific prior written
+	  permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/* compositionrejection.h/cpp
+
+CompositionRejectionGroup class contents:
+	- ReactionGroup implementing the composition-rejection direct method
+	  (Slepoy, Thompson and Plimpton, 2008)
+	- Sorts its members into bins by the power of two of their propensities,
+	  picking a bin by a linear search over the bins' sums and a member
+	  within the bin by rejection, at a cost independent of the member count
+*/
+
+#ifndef COMPOSITIONREJECTION_H
+#define COMPOSITIONREJECTION_H
+
+#include <climits>
+#include <vector>
+
+#include "reactiongroup.h"
+
+namespace sgns2 {
+
+// ===========================================================================
+class CompositionRejectionGroup : public ReactionGroup {
+public:
+	explicit CompositionRejectionGroup( Compartment *in ) throw();
+	virtual ~CompositionRejectionGroup() throw();
+
+	// ReactionGroup interface
+	virtual GroupMember *newMember( const reaction::Template *tmplate );
+	virtual void removeMember( GroupMember *member ) throw();
+	virtual void touch( GroupMember *member ) throw();
+
+	// Fires one of the members
+	virtual void trigger() throw();
+	// Recalculates the propensities of the touched members
+	virtual void update() throw();
+
+private:
+	// The slot of a Member is its position within its bin
+	class Member : public GroupMember {
+	public:
+		Member( CompositionRejectionGroup *group, const reaction::Template *tmplate ) throw()
+			: GroupMember( group, tmplate ), c(tmplate->getC()), a(0.0), bin(NO_BIN), touched(false) { }
+		virtual ~Member() throw() {
+			getGroup()->removeMember( this );
+		}
+
+		double c; // The reaction's stochastic constant at instantiation
+		double a; // The member's current propensity
+		int bin; // Exponent of the member's bin (NO_BIN if a == 0)
+		bool touched; // Set while the member is on the touched list
+	};
+	struct BinEntry {
+		double a; // Copy of the member's propensity, for the rejection step
+		Member *member;
+	};
+	struct Bin {
+		Bin() : sum(0.0) { }
+		std::vector<BinEntry> members; // The members in this bin
+		double sum; // Total propensity of the bin
+	};
+	static const int NO_BIN = INT_MIN;
+
+	// Recalculates the propensities of all touched members
+	void flushTouched() throw();
+	// Moves a member to the bin matching its new propensity
+	void setPropensity( Member *m, double a ) throw();
+	// Take a member out of its bin
+	void removeFromBin( Member *m ) throw();
+	// Sums the bins. Recalculates the sums from scratch every so often to
+	// keep the rounding errors of the incremental updates in check.
+	double sumBins() throw();
+
+	uint memberCount; // Number of members in the group
+	std::vector<Member*> touchedList; // Members touched since the last flush
+	// Bins by exponent. A member with propensity a lives in the bin with the
+	// exponent e such that 2^(e-1) < a <= 2^e.
+	std::vector<Bin> bins;
+	int binBase; // Exponent of bins[0]
+	uint incrementalUpdates; // Number of bin sum updates since the last resum
+};
+
+} // namespace sgns2
+
+#endif // COMPOSITIONREJECTION_H
@@ -10,6 +10,36 @@
 
 namespace sgns2 {
 
+// ---------------------------------------------------------------------------
+DistributionContext::~DistributionContext() {
+	delete[] splitBuffer;
+	for( size_t i = 0; i < delayBlocks.size(); i++ )
+		delete delayBlocks[i];
+	delete delays;
+}
+
+// ---------------------------------------------------------------------------
+void DistributionContext::refillDelays( RuntimeDistribution *distr, unsigned slot ) {
+	if( !delays ) {
+		// Scramble the seed, so that the delays of one simulation do not
+		// share a stream with another simulation seeded nearby
+		unsigned x = delaySeed;
+		x = (x ^ (x >> 16)) * 0x85ebca6bu;
+		x = (x ^ (x >> 13)) * 0xc2b2ae35u;
+		x ^= x >> 16;
+		delays = new DistributionContext( sim, x );
+	}
+	while( slot >= delayBlocks.size() ) {
+		DelayBlock *block = new DelayBlock;
+		block->next = DELAY_BLOCK_SIZE;
+		delayBlocks.push_back( block );
+	}
+
+	DelayBlock *block = delayBlocks[slot];
+	BasicRuntimeDistribution::sampleBlock( distr, block->samples, DELAY_BLOCK_SIZE, delays );
+	block->next = 0;
+}
+
 // ---------------------------------------------------------------------------
 void DistributionContext::allocateSplitBuffer( unsigned size ) {
 	delete[] splitBuffer;
@@ -138,4 +168,23 @@ double SGNS_FASTCALL BasicRuntimeDistribution::betaSampler( RuntimeDistribution
 	return dc->getRNG()->beta( me2->a1, me2->a2 );
 }
 
+// ---------------------------------------------------------------------------
+void BasicRuntimeDistribution::sampleBlock( RuntimeDistribution *distr, double *out, unsigned n, const DistributionContext *dc ) {
+	BasicRuntimeDistribution *me = (BasicRuntimeDistribution*)distr;
+	RNG::RNG *rng = dc->getRNG();
+	unsigned i;
+	if( me->distr_sampler == &gammaSampler ) {
+		rng->gamma( out, n, me->a1, me->a2 );
+	} else if( me->distr_sampler == &exponentialSampler ) {
+		for( i = 0; i < n; i++ )
+			out[i] = rng->exponential( me->a1 );
+	} else if( me->distr_sampler == &truncGaussianSampler ) {
+		for( i = 0; i < n; i++ )
+			out[i] = std::max( 0.0, rng->normal( me->a1, me->a2 ) );
+	} else {
+		for( i = 0; i < n; i++ )
+			out[i] = me->distr_sampler( me, dc );
+	}
+}
+
 } // namespace
@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 DistributionContext struct contents:
 	- Provides the link between the low-level distributions and the higher-level SimulationInstance
 	- Provides the distribution samplers with access to the simulation's random number generator
+	- Draws the samples of delay distributions in blocks, from a generator of their own
 
 RuntimeDistribution class contents:
 	- Stores a distribution function which can be called to sample the distribution
@@ -39,6 +40,7 @@ RuntimeDistribution class contents:
 BasicRuntimeDistribution class contents:
 	- Samplers for some more complex distributions:
 	    Uniform, Normal, Gamma, Beta
+	- Draws blocks of samples of any distribution
 */
 
 
@@ -46,6 +48,7 @@ BasicRuntimeDistribution class contents:
 #define RUNTIMEDISTRIBUTION_H
 
 #include <iostream>
+#include <vector>
 
 #include "rng.h"
 #include "simtypes.h"
@@ -53,14 +56,13 @@ BasicRuntimeDistribution class contents:
 namespace sgns2 {
 
 class SimulationInstance;
+class RuntimeDistribution;
 
 class DistributionContext {
 public:
 	DistributionContext( SimulationInstance *newSim, unsigned seed )
-		: sim(newSim), splitBuffer(NULL), rng(seed) { }
-	~DistributionContext() {
-		delete splitBuffer;
-	}
+		: sim(newSim), splitBuffer(NULL), rng(seed), delaySeed(seed), delays(NULL) { }
+	~DistributionContext();
 
 	void allocateSplitBuffer( unsigned size );
 
@@ -68,10 +70,28 @@ public:
 	inline Population *getSplitBuffer() const throw() { return splitBuffer; }
 	inline RNG::RNG *getRNG() const throw() { return &rng; }
 
+	// Draws a sample of the delay distribution with the given slot. The
+	// samples come from a block drawn ahead, with a generator kept for
+	// delays, so they do not depend on the other uses of the simulation's.
+	inline double sampleDelay( RuntimeDistribution *distr, unsigned slot );
+
 private:
 	SimulationInstance *sim;
 	Population *splitBuffer;
 	mutable RNG::RNG rng;
+
+	enum { DELAY_BLOCK_SIZE = 256 };
+	struct DelayBlock {
+		unsigned next; // Index of the next sample to use
+		double samples[DELAY_BLOCK_SIZE];
+	};
+	// Blocks of samples for each slot, made when first needed
+	std::vector< DelayBlock* > delayBlocks;
+	unsigned delaySeed;
+	// Context of the generator for delays, made when first needed
+	DistributionContext *delays;
+	// Draws a new block of samples for the slot
+	void refillDelays( RuntimeDistribution *distr, unsigned slot );
 };
 
 class RuntimeDistribution {
@@ -117,6 +137,13 @@ protected:
 	double a2;
 };
 
+inline double DistributionContext::sampleDelay( RuntimeDistribution *distr, unsigned slot ) {
+	if( slot >= delayBlocks.size() || delayBlocks[slot]->next == DELAY_BLOCK_SIZE )
+		refillDelays( distr, slot );
+	DelayBlock *block = delayBlocks[slot];
+	return block->samples[block->next++];
+}
+
 class BasicRuntimeDistribution : public RuntimeDistribution {
 public:
 	// ~ U*(x-m)+m, in range [m,x)
@@ -140,6 +167,10 @@ public:
 	// ~ Beta(alpha,beta)
 	static RuntimeDistribution BetaDistribution( double alpha, double beta );
 
+	// Draws n samples of the distribution at once. The common distributions
+	// are sampled without going through their samplers one by one.
+	static void sampleBlock( RuntimeDistribution *distr, double *out, unsigned n, const DistributionContext *dc );
+
 protected:
 	// Samplers
 	static double SGNS_FASTCALL uniformSampler( RuntimeDistribution *me, const DistributionContext *dc );
@@ -5,6 +5,8 @@
 
 #include <limits>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
 
 #include "event.h"
 
@@ -29,34 +31,152 @@ void SGNS_FASTCALL EventQueueBase::empty_newMin( EventQueueBase *q ) {
 }
 
 // ---------------------------------------------------------------------------
-EventQueue_BinaryHeap::EventQueue_BinaryHeap() throw()
+EventQueue_Indexed::Backend EventQueue_Indexed::defaultBackend = EventQueue_Indexed::BINARY_HEAP;
+
+// ---------------------------------------------------------------------------
+bool EventStream::taggedDispatch = true;
+
+// ---------------------------------------------------------------------------
+// Children per node in the SOA_HEAP, so that each group of sibling keys
+// fills one cache line
+static const uint soaArity = 8;
+
+// ---------------------------------------------------------------------------
+static const char *const backendNames[EventQueue_Indexed::BACKEND_COUNT] = {
+	"binary",
+	"4ary",
+	"soa",
+	"tournament"
+};
+
+// ---------------------------------------------------------------------------
+const char *EventQueue_Indexed::getBackendName( Backend b ) throw() {
+	assert( b < BACKEND_COUNT );
+	return backendNames[b];
+}
+
+// ---------------------------------------------------------------------------
+bool EventQueue_Indexed::findBackend( const char *name, Backend &b ) throw() {
+	for( uint i = 0; i < BACKEND_COUNT; i++ ) {
+		if( 0 == strcmp( name, backendNames[i] ) ) {
+			b = (Backend)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// ---------------------------------------------------------------------------
+EventQueue_Indexed::EventQueue_Indexed() throw()
 : heapSize(1)
-, heapCapacity(8)
+, heapCapacity(0)
 , heap(NULL)
+, top(1)
+, links(NULL)
+, keys(NULL)
+, heapBlock(NULL)
+, indexBlock(NULL)
+, backend((unsigned char)defaultBackend)
 {
-	heap = new EventQueueEntry[heapCapacity];
-	heap[0].time = -std::numeric_limits<double>::infinity();
+	if( backend == TOURNAMENT_TREE )
+		top = 0;
+	resize( INLINE_CAPACITY );
 }
 
 // ---------------------------------------------------------------------------
-EventQueue_BinaryHeap::~EventQueue_BinaryHeap() throw() {
-	delete[] heap;
+EventQueue_Indexed::~EventQueue_Indexed() throw() {
+	delete[] heapBlock;
+	delete[] indexBlock;
 }
 
 // ---------------------------------------------------------------------------
-void EventQueue_BinaryHeap::resize( uint newCapacity ) throw() {
+void EventQueue_Indexed::resize( uint newCapacity ) throw() {
 	assert( heapSize <= newCapacity );
 
-	EventQueueEntry *newHeap = new EventQueueEntry[newCapacity];
-	memcpy( newHeap, heap, heapSize * sizeof( EventQueueEntry ) );
+	// Place heap[2] on a cache line boundary so that each group of siblings
+	// in the 4-ary heap shares a single cache line
+	const size_t lineSize = 64, offset = 2 * sizeof( EventQueueEntry );
+	char *newBlock = NULL;
+	EventQueueEntry *newHeap = inlineHeap;
+	if( newCapacity > INLINE_CAPACITY ) {
+		newBlock = new char[newCapacity * sizeof( EventQueueEntry ) + lineSize];
+		size_t aligned = ((size_t)newBlock + offset + lineSize - 1) & ~(lineSize - 1);
+		newHeap = reinterpret_cast<EventQueueEntry*>(aligned - offset);
+	}
+	if( heap ) {
+		memcpy( newHeap, heap, heapSize * sizeof( EventQueueEntry ) );
+	} else if( backend == SOA_HEAP ) {
+		// Entries are indexed by handle, the sentinel lives in keys
+		newHeap[0].time = 0.0;
+		newHeap[0].evt = NULL;
+	} else if( backend == TOURNAMENT_TREE ) {
+		// Empty slots lose every match
+		newHeap[0].time = std::numeric_limits<double>::infinity();
+		newHeap[0].evt = NULL;
+	} else {
+		// Sentinel above the root
+		newHeap[0].time = -std::numeric_limits<double>::infinity();
+		newHeap[0].evt = NULL;
+	}
 
+	uint oldCapacity = heapCapacity;
 	heapCapacity = newCapacity;
-	delete[] heap;
+	delete[] heapBlock;
+	heapBlock = newBlock;
 	heap = newHeap;
+
+	if( backend == SOA_HEAP ) {
+		// Keys and links share one block, with each group of siblings in
+		// the keys on a single cache line
+		const size_t keyOffset = 2 * sizeof( double );
+		char *newIndexBlock = new char[newCapacity * (sizeof( double ) + 2 * sizeof( uint )) + lineSize];
+		size_t alignedKeys = ((size_t)newIndexBlock + keyOffset + lineSize - 1) & ~(lineSize - 1);
+		double *newKeys = reinterpret_cast<double*>(alignedKeys - keyOffset);
+		uint *newLinks = reinterpret_cast<uint*>(newKeys + newCapacity);
+		if( keys ) {
+			memcpy( newKeys, keys, heapSize * sizeof( double ) );
+			memcpy( newLinks, links, heapSize * sizeof( uint ) );
+			memcpy( newLinks + newCapacity, links + oldCapacity, heapSize * sizeof( uint ) );
+		} else {
+			// Sentinel above the root
+			newKeys[0] = -std::numeric_limits<double>::infinity();
+			newLinks[0] = newLinks[newCapacity] = 0;
+		}
+		delete[] indexBlock;
+		indexBlock = newIndexBlock;
+		keys = newKeys;
+		links = newLinks;
+	} else if( backend == TOURNAMENT_TREE ) {
+		// Rebuild the tree: the leaves are links[newCapacity..2*newCapacity-1]
+		delete[] indexBlock;
+		indexBlock = new char[(newCapacity << 1) * sizeof( uint )];
+		uint *tree = links = reinterpret_cast<uint*>(indexBlock);
+		for( uint i = 0; i < newCapacity; i++ )
+			tree[newCapacity + i] = i < heapSize && i > 0 ? i : 0;
+		for( uint n = newCapacity - 1; n > 0; n-- ) {
+			uint a = tree[n << 1], b = tree[(n << 1) + 1];
+			tree[n] = heap[b].time < heap[a].time ? b : a;
+		}
+		tree[0] = 0;
+	}
 }
 
 // ---------------------------------------------------------------------------
-void EventQueue_BinaryHeap::bubbleAround( EventQueueEntry *entry, uint i ) throw() {
+size_t EventQueue_Indexed::getHeapMemory() const throw() {
+	const size_t lineSize = 64;
+	size_t bytes = 0;
+	if( heapBlock )
+		bytes += heapCapacity * sizeof( EventQueueEntry ) + lineSize;
+	if( backend == SOA_HEAP ) {
+		bytes += heapCapacity * (sizeof( double ) + 2 * sizeof( uint )) + lineSize;
+	} else if( backend == TOURNAMENT_TREE ) {
+		bytes += (heapCapacity << 1) * sizeof( uint );
+	}
+	return bytes;
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::bubbleAround( EventQueueEntry *entry, uint i ) throw() {
 	uint ni = i >> 1;
 	if( entry->time < heap[ni].time ) {
 		heap[ni].evt->queueIndex = i;
@@ -68,7 +188,7 @@ void EventQueue_BinaryHeap::bubbleAround( EventQueueEntry *entry, uint i ) throw
 }
 
 // ---------------------------------------------------------------------------
-void EventQueue_BinaryHeap::bubbleUp( EventQueueEntry *entry, uint i ) throw() {
+void EventQueue_Indexed::bubbleUp( EventQueueEntry *entry, uint i ) throw() {
 	double t = entry->time;
 	assert( t >= getBaseTime() );
 	
@@ -88,7 +208,7 @@ void EventQueue_BinaryHeap::bubbleUp( EventQueueEntry *entry, uint i ) throw() {
 }
 
 // ---------------------------------------------------------------------------
-void EventQueue_BinaryHeap::bubbleDown( EventQueueEntry *entry, uint i ) throw() {
+void EventQueue_Indexed::bubbleDown( EventQueueEntry *entry, uint i ) throw() {
 	bool callNewMin = i == 1;
 
 	double t = entry->time;
@@ -130,6 +250,256 @@ void EventQueue_BinaryHeap::bubbleDown( EventQueueEntry *entry, uint i ) throw()
 		newMin( this );
 }
 
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::bubbleAround4( EventQueueEntry *entry, uint i ) throw() {
+	uint ni = (i + 2) >> 2;
+	if( entry->time < heap[ni].time ) {
+		heap[ni].evt->queueIndex = i;
+		heap[i] = heap[ni];
+		bubbleUp4( entry, ni );
+	} else {
+		bubbleDown4( entry, i );
+	}
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::bubbleUp4( EventQueueEntry *entry, uint i ) throw() {
+	double t = entry->time;
+	assert( t >= getBaseTime() );
+
+	uint ni = (i + 2) >> 2;
+	while( heap[ni].time > t ) {
+		heap[ni].evt->queueIndex = i;
+		heap[i] = heap[ni];
+		ni = ((i = ni) + 2) >> 2;
+	}
+
+	heap[i].time = t;
+	heap[i].evt = entry->evt;
+	entry->evt->queueIndex = i;
+
+	if( i == 1 )
+		newMin( this );
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::bubbleDown4( EventQueueEntry *entry, uint i ) throw() {
+	bool callNewMin = i == 1;
+
+	double t = entry->time;
+	assert( t >= getBaseTime() );
+	while( true ) {
+		uint first = (i << 2) - 2;
+		if( first >= heapSize )
+			break; // No children
+
+		// Find the soonest child
+		uint last = std::min( first + 4, heapSize );
+		uint ni = first;
+		double nt = heap[first].time;
+		for( uint c = first + 1; c < last; c++ ) {
+			if( heap[c].time < nt ) {
+				nt = heap[c].time;
+				ni = c;
+			}
+		}
+
+		if( !(nt < t) )
+			break; // All children are later than t - don't bubble down further
+
+		assert( nt >= getBaseTime() );
+		heap[ni].evt->queueIndex = i;
+		heap[i] = heap[ni];
+		i = ni;
+	}
+
+	heap[i].time = t;
+	heap[i].evt = entry->evt;
+	entry->evt->queueIndex = i;
+
+	if( callNewMin )
+		newMin( this );
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::siftUpSoA( double t, uint h, uint i ) throw() {
+	assert( t >= getBaseTime() );
+	uint *handleAt = links, *slotOf = links + heapCapacity;
+
+	uint ni = (i + soaArity - 2) / soaArity;
+	while( keys[ni] > t ) {
+		uint nh = handleAt[ni];
+		keys[i] = keys[ni];
+		handleAt[i] = nh;
+		slotOf[nh] = i;
+		i = ni;
+		ni = (i + soaArity - 2) / soaArity;
+	}
+
+	keys[i] = t;
+	handleAt[i] = h;
+	slotOf[h] = i;
+
+	if( i == 1 ) {
+		top = h;
+		newMin( this );
+	}
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::siftDownSoA( double t, uint h, uint i ) throw() {
+	assert( t >= getBaseTime() );
+	uint *handleAt = links, *slotOf = links + heapCapacity;
+	bool callNewMin = i == 1;
+
+	while( true ) {
+		uint first = i * soaArity + 2 - soaArity;
+		if( first >= heapSize )
+			break; // No children
+
+		// Find the soonest child
+		uint last = std::min( first + soaArity, heapSize );
+		uint ni = first;
+		double nt = keys[first];
+		for( uint c = first + 1; c < last; c++ ) {
+			if( keys[c] < nt ) {
+				nt = keys[c];
+				ni = c;
+			}
+		}
+		if( !(nt < t) )
+			break; // All children are later than t - don't sift down further
+
+		uint nh = handleAt[ni];
+		keys[i] = keys[ni];
+		handleAt[i] = nh;
+		slotOf[nh] = i;
+		i = ni;
+	}
+
+	keys[i] = t;
+	handleAt[i] = h;
+	slotOf[h] = i;
+
+	if( callNewMin ) {
+		top = handleAt[1];
+		newMin( this );
+	}
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::addSoA( EventQueueEntry *entry ) throw() {
+	if( heapSize >= heapCapacity )
+		resize( heapCapacity << 1 );
+
+	// The new handle and heap position are both at the end
+	uint h = heapSize++;
+	heap[h] = *entry;
+	entry->evt->queueIndex = h;
+	siftUpSoA( entry->time, h, h );
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::removeSoA( uint h ) throw() {
+	uint *handleAt = links, *slotOf = links + heapCapacity;
+	uint i = slotOf[h];
+	uint last = --heapSize;
+	heap[h].evt->queueIndex = 0;
+
+	if( h < last ) {
+		// Move the last handle into h so that handles stay dense
+		heap[h] = heap[last];
+		heap[h].evt->queueIndex = h;
+		uint lastSlot = slotOf[last];
+		slotOf[h] = lastSlot;
+		handleAt[lastSlot] = h;
+		if( top == last )
+			top = h;
+	}
+
+	if( i < last ) {
+		// Fill the hole with the last heap position
+		double t = keys[last];
+		if( t < keys[(i + soaArity - 2) / soaArity] ) {
+			siftUpSoA( t, handleAt[last], i );
+		} else {
+			siftDownSoA( t, handleAt[last], i );
+		}
+	} else if( isEmpty() ) {
+		newMin( this );
+	}
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::rescheduleSoA( EventQueueEntry *entry, uint h ) throw() {
+	double t = entry->time;
+	uint i = links[heapCapacity + h];
+	heap[h].time = t;
+	if( t < keys[i] ) {
+		siftUpSoA( t, h, i );
+	} else {
+		siftDownSoA( t, h, i );
+	}
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::replay( uint i ) throw() {
+	uint *tree = links;
+	uint n = (heapCapacity + i) >> 1;
+	while( n > 0 ) {
+		uint a = tree[n << 1], b = tree[(n << 1) + 1];
+		uint winner = heap[b].time < heap[a].time ? b : a;
+		if( winner == tree[n] && winner != i )
+			break; // Nothing changes further up the tree
+		tree[n] = winner;
+		n >>= 1;
+	}
+}
+
+// ---------------------------------------------------------------------------
+inline void EventQueue_Indexed::updateTop( uint changed ) throw() {
+	if( links[1] != top || top == changed ) {
+		top = links[1];
+		newMin( this );
+	}
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::addTournament( EventQueueEntry *entry ) throw() {
+	assert( entry->time >= getBaseTime() );
+	if( heapSize >= heapCapacity )
+		resize( heapCapacity << 1 );
+
+	uint i = heapSize++;
+	heap[i] = *entry;
+	entry->evt->queueIndex = i;
+	links[heapCapacity + i] = i;
+	replay( i );
+	updateTop( i );
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::removeTournament( uint i ) throw() {
+	heap[i].evt->queueIndex = 0;
+	uint last = --heapSize;
+	links[heapCapacity + last] = 0;
+	if( i != last ) {
+		// Fill the hole with the last entry
+		heap[i] = heap[last];
+		heap[i].evt->queueIndex = i;
+		replay( last );
+	}
+	replay( i );
+	updateTop( i );
+}
+
+// ---------------------------------------------------------------------------
+void EventQueue_Indexed::rescheduleTournament( EventQueueEntry *entry, uint i ) throw() {
+	assert( entry->time >= getBaseTime() );
+	heap[i].time = entry->time;
+	replay( i );
+	updateTop( i );
+}
 
 // ---------------------------------------------------------------------------
 Event::Event( EventQueue *parent ) throw()
@@ -149,11 +519,7 @@ void Event::enqueue( double newTime ) throw() {
 	entry.evt = this;
 	entry.time = newTime;
 	if( isInQueue() ) {
-		if( newTime < getNextEventTimeRaw() ) {
-			parentQueue->bubbleUp( &entry, queueIndex );
-		} else {
-			parentQueue->bubbleDown( &entry, queueIndex );
-		}
+		parentQueue->reschedule( &entry, queueIndex );
 	} else {
 		parentQueue->add( &entry );
 	}
@@ -166,4 +532,18 @@ void Event::dequeue() throw() {
 		parentQueue->remove( queueIndex );
 }
 
+// ---------------------------------------------------------------------------
+void UpdateList::updateAll() throw() {
+	while( !pending.empty() ) {
+		// Streams queued from here on are stamped with the new epoch, and
+		// wait for the next round
+		taken.swap( pending );
+		if( ++epoch == 0 )
+			epoch = 1;
+		for( size_t i = 0; i < taken.size(); i++ )
+			dispatchUpdate( taken[i] );
+		taken.clear();
+	}
+}
+
 } // namespace
@@ -31,8 +31,18 @@ EventQueueBase class contents:
 	- Abstract class representing a priority queue
 	- Stores the 'current time' for the queue
 
-EventQueue_BinaryHeap class contents:
-	- Binary Heap implementation of EventQueueBase
+EventQueue_Indexed class contents:
+	- Indexed priority queue implementation of EventQueueBase
+	- The layout of the queue can be selected at run-time:
+		- Binary heap (default)
+		- 4-ary heap, with each group of siblings on one cache line
+		- 8-ary heap on a dense array of times, with the mapping between
+		  events and heap positions kept in side tables
+		- Tournament tree, in which rescheduling an event only replays the
+		  matches on its path to the root, and an event moves only to fill
+		  the place of a removed one
+	- Keeps small queues inside the object, allocating only once they
+	  outgrow it
 
 Event class contents:
 	- Base class for any event which is inserted into an EventQueue
@@ -40,6 +50,20 @@ Event class contents:
 
 EventStream class contents:
 	- Base class for a recurring event
+	- Tagged with the kind of its concrete class, for the common ones
+
+dispatchTrigger and dispatchUpdate (in eventdispatch.cpp):
+	- Call trigger() and update() on an EventStream, switching over its
+	  kind to call the common concrete classes directly, so that their
+	  code is inlined instead of reached through the vtable
+
+UpdateList class contents:
+	- The EventStreams waiting for an update() call before the next step
+	- Dense, reusable arrays, so queueing a stream allocates nothing once
+	  they have grown
+	- Queueing a stream which is already pending does nothing. Streams are
+	  stamped with the list's epoch when queued, and the epoch moves on
+	  when the pending streams are taken, so no marks need clearing.
 
 EventStreamQueue class contents:
 	- EventQueue specialized for containing EventStreams
@@ -50,8 +74,8 @@ EventStreamQueue class contents:
 #define EVENTQUEUE_H
 
 #include "simtypes.h"
-#include "simplesll.h"
 #include <limits>
+#include <vector>
 
 namespace sgns2
 {
@@ -82,34 +106,62 @@ protected:
 };
 
 // ===========================================================================
-class EventQueue_BinaryHeap : public EventQueueBase {
+class EventQueue_Indexed : public EventQueueBase {
 	friend class Event;
 public:
-	EventQueue_BinaryHeap() throw();
-	virtual ~EventQueue_BinaryHeap() throw();
+	// Available queue layouts
+	enum Backend {
+		BINARY_HEAP = 0,
+		QUATERNARY_HEAP,
+		SOA_HEAP, // Experimental, slower than BINARY_HEAP so far
+		TOURNAMENT_TREE,
+		BACKEND_COUNT
+	};
+
+	EventQueue_Indexed() throw();
+	virtual ~EventQueue_Indexed() throw();
 
 	// Access the next event's time, assumes !isEmpty()
-	inline double getNextEventTimeRaw() const throw() { return heap[1].time; }
+	inline double getNextEventTimeRaw() const throw() { return heap[top].time; }
 	// Access to the next event's time
 	inline double getNextEventTime() const throw() {
 		return isEmpty() ? std::numeric_limits<double>::infinity() : getNextEventTimeRaw(); }
 	// Peek at the next event's stream, assumes !isEmpty()
-	inline Event *getNextEvent() const throw() { return heap[1].evt; }
+	inline Event *getNextEvent() const throw() { return heap[top].evt; }
 	// Is the wait list empty?
 	inline bool isEmpty() const throw() { return heapSize == 1; }
 
+	// The layout of this queue
+	inline Backend getBackend() const throw() { return (Backend)backend; }
+
+	// The layout used by queues created from now on
+	static inline Backend getDefaultBackend() throw() { return defaultBackend; }
+	static inline void setDefaultBackend( Backend b ) throw() { defaultBackend = b; }
+	// Backend names, as used by the event_queue identifier
+	static const char *getBackendName( Backend b ) throw();
+	static bool findBackend( const char *name, Backend &b ) throw();
+
+	// Bytes allocated for the queue outside of the object
+	size_t getHeapMemory() const throw();
+
 private:
 	struct EventQueueEntry {
 		double time;
 		Event *evt;
 	};
+	// Number of entries, including the one at index 0, kept in the object
+	enum { INLINE_CAPACITY = 4 };
 
 	// Adds an event stream
 	inline void add( EventQueueEntry *entry ) throw();
 	// Removes an event stream
 	inline void remove( uint i ) throw();
-	// Resize the heap to fit more entries
+	// Moves the event stream at i to the time in entry
+	inline void reschedule( EventQueueEntry *entry, uint i ) throw();
+	// Resize the queue to fit more entries
 	void resize( uint newCapacity ) throw();
+
+	// Binary heap
 	// Move the entry up or down in the heap, depending on what is at i
 	void bubbleAround( EventQueueEntry *entry, uint i ) throw();
 	// Move the entry up in the heap from i
@@ -117,17 +169,56 @@ private:
 	// Move the entry down in the heap from i
 	void bubbleDown( EventQueueEntry *entry, uint i ) throw();
 
+	// 4-ary heap
+	// The children of i are 4i-2 .. 4i+1, the parent is (i+2)/4
+	void bubbleAround4( EventQueueEntry *entry, uint i ) throw();
+	void bubbleUp4( EventQueueEntry *entry, uint i ) throw();
+	void bubbleDown4( EventQueueEntry *entry, uint i ) throw();
+
+	// Structure-of-arrays heap
+	// Entries are indexed by handles which stay fixed while the event is
+	// queued, so sifting only touches the dense keys and links arrays
+	// The children of i are 8i-6 .. 8i+1, the parent is (i+6)/8
+	void addSoA( EventQueueEntry *entry ) throw();
+	void removeSoA( uint h ) throw();
+	void rescheduleSoA( EventQueueEntry *entry, uint h ) throw();
+	void siftUpSoA( double t, uint h, uint i ) throw();
+	void siftDownSoA( double t, uint h, uint i ) throw();
+
+	// Tournament tree
+	// Entries are the leaves of the tree and stay in place, the inner
+	// nodes store the index of the soonest entry below them
+	void addTournament( EventQueueEntry *entry ) throw();
+	void removeTournament( uint i ) throw();
+	void rescheduleTournament( EventQueueEntry *entry, uint i ) throw();
+	// Replays the matches on the path from the leaf i to the root
+	void replay( uint i ) throw();
+	// Finds the new winner and reports it if it changed
+	inline void updateTop( uint changed ) throw();
+
 	uint heapSize;
 	uint heapCapacity;
 	EventQueueEntry *heap;
+	uint top; // Index of the soonest entry
+	// Index arrays of 2*heapCapacity elements
+	//   SOA_HEAP: the handle at each heap position, then the position of
+	//     each handle
+	//   TOURNAMENT_TREE: the tree nodes, with the leaves in the second half
+	uint *links;
+	double *keys; // Times in heap order (SOA_HEAP only)
+	char *heapBlock; // Allocation holding the heap, or NULL if inline
+	char *indexBlock; // Allocation holding the links and keys
+	unsigned char backend;
+	EventQueueEntry inlineHeap[INLINE_CAPACITY]; // The heap, while it fits
+
+	static Backend defaultBackend;
 };
 
-typedef EventQueue_BinaryHeap EventQueue;
+typedef EventQueue_Indexed EventQueue;
 
 // ===========================================================================
 class Event {
-	friend class EventQueue_BinaryHeap;
-	friend class EventQueue_BinomialHeap;
+	friend class EventQueue_Indexed;
 public:
 	explicit Event( EventQueue *parent ) throw();
 	~Event() throw();
@@ -142,6 +233,15 @@ protected:
 	void enqueue( double newTime ) throw();
 	// Remove the event stream from the queue
 	void dequeue() throw();
+	// Place the event stream at a particular point in the queue, or remove
+	// it from the queue if it will never happen (newTime is infinite)
+	inline void schedule( double newTime ) throw() {
+		if( newTime < std::numeric_limits<double>::infinity() ) {
+			enqueue( newTime );
+		} else {
+			dequeue();
+		}
+	}
 	// Is the event stream in the queue?
 	inline bool isInQueue() const throw() { return queueIndex > 0; }
 	// Change the event queue this is a part of
@@ -165,7 +265,15 @@ inline double Event::getNextEventTimeRaw() throw() {
 }
 
 // ---------------------------------------------------------------------------
-inline void EventQueue_BinaryHeap::add( EventQueueEntry *entry ) throw() {
+inline void EventQueue_Indexed::add( EventQueueEntry *entry ) throw() {
+	if( backend == SOA_HEAP ) {
+		addSoA( entry );
+		return;
+	} else if( backend == TOURNAMENT_TREE ) {
+		addTournament( entry );
+		return;
+	}
+
 	if( heapSize >= heapCapacity ) {
 		resize( heapCapacity << 1 );
 	} else if( heapSize == 1 ) {
@@ -178,26 +286,70 @@ inline void EventQueue_BinaryHeap::add( EventQueueEntry *entry ) throw() {
 		return;
 	}
 	heapSize++;
-	bubbleUp( entry, heapSize-1 );
+	if( backend == BINARY_HEAP ) {
+		bubbleUp( entry, heapSize-1 );
+	} else {
+		bubbleUp4( entry, heapSize-1 );
+	}
 }
 
 // ---------------------------------------------------------------------------
-inline void EventQueue_BinaryHeap::remove( uint i ) throw() {
+inline void EventQueue_Indexed::remove( uint i ) throw() {
+	if( backend == SOA_HEAP ) {
+		removeSoA( i );
+		return;
+	} else if( backend == TOURNAMENT_TREE ) {
+		removeTournament( i );
+		return;
+	}
+
 	heap[i].evt->queueIndex = 0;
 	heapSize--;
-	if( !isEmpty() ) {
-		bubbleAround( &heap[heapSize], i );
-	} else {
+	if( i < heapSize ) {
+		// Fill the hole with the last entry
+		if( backend == BINARY_HEAP ) {
+			bubbleAround( &heap[heapSize], i );
+		} else {
+			bubbleAround4( &heap[heapSize], i );
+		}
+	} else if( isEmpty() ) {
 		newMin( this );
 	}
 }
 
+// ---------------------------------------------------------------------------
+inline void EventQueue_Indexed::reschedule( EventQueueEntry *entry, uint i ) throw() {
+	switch( backend ) {
+	case BINARY_HEAP:
+		if( entry->time < heap[i].time ) {
+			bubbleUp( entry, i );
+		} else {
+			bubbleDown( entry, i );
+		}
+		break;
+	case QUATERNARY_HEAP:
+		if( entry->time < heap[i].time ) {
+			bubbleUp4( entry, i );
+		} else {
+			bubbleDown4( entry, i );
+		}
+		break;
+	case SOA_HEAP:
+		rescheduleSoA( entry, i );
+		break;
+	default:
+		rescheduleTournament( entry, i );
+		break;
+	}
+}
+
 // ===========================================================================
 class EventStreamQueue;
 class EventStream : public Event {
+	friend class UpdateList;
 public:
 	explicit EventStream( EventQueue *parent ) throw()
-		: Event( parent ) { }
+		: Event( parent ), updateStamp(0), kind(KIND_VIRTUAL) { }
 	virtual ~EventStream() throw() { };
 
 	// Triggers the event
@@ -207,12 +359,73 @@ public:
 
 	// Schedules the EventStream for an update() call
 	inline void scheduleForUpdate();
+
+	// Concrete classes which dispatchTrigger and dispatchUpdate call directly
+	enum Kind {
+		KIND_VIRTUAL, // Anything else, called through the vtable
+		KIND_COMPARTMENT, // Compartment
+		KIND_WAITLIST, // WaitList
+		KIND_REACTION, // reaction::Template::Instance
+		KIND_ZEROTH_ORDER, // reaction::Template::ZerothOrderInstance
+		KIND_FIRST_ORDER, // reaction::Template::FirstOrderInstance
+		KIND_SECOND_ORDER, // reaction::Template::SecondOrderInstance
+		KIND_DIMER // reaction::Template::DimerInstance
+	};
+	inline Kind getKind() const throw() { return (Kind)kind; }
+	// Tags the stream with the kind of its concrete class. Has no effect
+	// while tagged dispatch is off.
+	inline void setKind( Kind k ) throw() {
+		kind = (unsigned char)(taggedDispatch ? k : KIND_VIRTUAL); }
+
+	// Manage whether streams created from now on are tagged (the default)
+	static inline void setTaggedDispatch( bool on ) { taggedDispatch = on; }
+	static inline bool isTaggedDispatch() { return taggedDispatch; }
+
+private:
+	// Epoch of the UpdateList when the stream was last queued on it
+	uint updateStamp;
+	// The Kind of the stream
+	unsigned char kind;
+
+	static bool taggedDispatch;
+};
+
+// Calls trigger() or update() on the stream
+void dispatchTrigger( EventStream *s ) throw();
+void dispatchUpdate( EventStream *s ) throw();
+
+// ===========================================================================
+class UpdateList {
+public:
+	UpdateList() throw() : epoch(1) { }
+	~UpdateList() throw() { }
+
+	// Queues a stream for an update() call, unless it is already pending
+	inline void push_back( EventStream *s ) {
+		if( s->updateStamp != epoch ) {
+			s->updateStamp = epoch;
+			pending.push_back( s );
+		}
+	}
+	// Are there any streams waiting?
+	inline bool empty() const throw() { return pending.empty(); }
+	// Calls update() on the pending streams in the order they were queued,
+	// including the ones queued by those calls, until none are left
+	void updateAll() throw();
+
+private:
+	// Streams queued in the current epoch
+	std::vector< EventStream* > pending;
+	// The streams being updated. Kept to reuse its storage.
+	std::vector< EventStream* > taken;
+	// Stamp of the streams queued since the pending ones were last taken
+	uint epoch;
 };
 
 // ===========================================================================
 class EventStreamQueue : public EventQueue {
 public:
-	EventStreamQueue( SimpleSLL *updateQueue ) throw()
+	EventStreamQueue( UpdateList *updateQueue ) throw()
 		: toUpdate(updateQueue)
 	{ }
 	~EventStreamQueue() throw() { }
@@ -222,14 +435,14 @@ public:
 		toUpdate->push_back( s );
 	}
 
-	inline SimpleSLL *getUpdateQueue() const { return toUpdate; }
+	inline UpdateList *getUpdateQueue() const { return toUpdate; }
 
 	inline EventStream *getNextEvent() const throw() {
 		return static_cast<EventStream*>(EventQueue::getNextEvent());
 	}
 
 protected:
-	SimpleSLL *toUpdate;
+	UpdateList *toUpdate;
 };
 
 // ---------------------------------------------------------------------------
@@ -0,0 +1,78 @@
+// See event.h for a description of the contents of this file.
+
+#include "stdafx.h"
+
+#include "event.h"
+#include "compartment.h"
+#include "reaction.h"
+#include "waitlist.h"
+
+namespace sgns2 {
+
+using reaction::Template;
+
+// ---------------------------------------------------------------------------
+// The qualified calls below are not virtual, so the compiler can inline the
+// concrete classes' trigger() and update() into the switch
+
+// ---------------------------------------------------------------------------
+void dispatchTrigger( EventStream *s ) throw() {
+	switch( s->getKind() ) {
+	case EventStream::KIND_COMPARTMENT:
+		static_cast<Compartment*>(s)->Compartment::trigger();
+		break;
+	case EventStream::KIND_WAITLIST:
+		static_cast<WaitList*>(s)->WaitList::trigger();
+		break;
+	case EventStream::KIND_REACTION:
+		static_cast<Template::Instance*>(s)->Template::Instance::trigger();
+		break;
+	case EventStream::KIND_ZEROTH_ORDER:
+		static_cast<Template::ZerothOrderInstance*>(s)->Template::ZerothOrderInstance::trigger();
+		break;
+	case EventStream::KIND_FIRST_ORDER:
+		static_cast<Template::FirstOrderInstance*>(s)->Template::FirstOrderInstance::trigger();
+		break;
+	case EventStream::KIND_SECOND_ORDER:
+		static_cast<Template::SecondOrderInstance*>(s)->Template::SecondOrderInstance::trigger();
+		break;
+	case EventStream::KIND_DIMER:
+		static_cast<Template::DimerInstance*>(s)->Template::DimerInstance::trigger();
+		break;
+	default:
+		s->trigger();
+		break;
+	}
+}
+
+// ---------------------------------------------------------------------------
+void dispatchUpdate( EventStream *s ) throw() {
+	switch( s->getKind() ) {
+	case EventStream::KIND_COMPARTMENT:
+		static_cast<Compartment*>(s)->Compartment::update();
+		break;
+	case EventStream::KIND_WAITLIST:
+		static_cast<WaitList*>(s)->WaitList::update();
+		break;
+	case EventStream::KIND_REACTION:
+		static_cast<Template::Instance*>(s)->Template::Instance::update();
+		break;
+	case EventStream::KIND_ZEROTH_ORDER:
+		static_cast<Template::ZerothOrderInstance*>(s)->Template::ZerothOrderInstance::update();
+		break;
+	case EventStream::KIND_FIRST_ORDER:
+		static_cast<Template::FirstOrderInstance*>(s)->Template::FirstOrderInstance::update();
+		break;
+	case EventStream::KIND_SECOND_ORDER:
+		static_cast<Template::SecondOrderInstance*>(s)->Template::SecondOrderInstance::update();
+		break;
+	case EventStream::KIND_DIMER:
+		static_cast<Template::DimerInstance*>(s)->Template::DimerInstance::update();
+		break;
+	default:
+		s->update();
+		break;
+	}
+}
+
+} // namespace sgns2
@@ -36,8 +36,8 @@ HierCompartment::~HierCompartment() throw() {
 	// propagate timing or update changes up the heap while the
 	// reactions are being destroyed
 	newMin = &empty_newMin;
-	removedDepCount = 1;
-	SimpleSLL deadEndUpdateList;
+	destroying = true;
+	UpdateList deadEndUpdateList;
 	toUpdate = &deadEndUpdateList;
 
 	// Destroy all subcompartments
@@ -49,6 +49,17 @@ HierCompartment::~HierCompartment() throw() {
 	getSimulation()->update();
 }
 
+// ---------------------------------------------------------------------------
+void HierCompartment::addSubtreeMemoryUsage( CompartmentMemory &mem ) const throw() {
+	mem.count++;
+	mem.objects += sizeof( HierCompartment );
+	addMemoryUsage( mem );
+	if( mainBank )
+		mem.reactions += myType->getBank()->getInstanceMemory();
+	for( const HierCompartment *sub = firstSubCompartment; sub; sub = sub->nextInContainer )
+		sub->addSubtreeMemoryUsage( mem );
+}
+
 // ---------------------------------------------------------------------------
 void HierCompartment::orphanCompartment() {
 	if( container ) {
@@ -32,6 +32,7 @@ HierCompartment class contents:
 	  parent, siblings and children)
 	- Each HierCompartment is of a specific CompartmentType
 	- Manages its CompartmentType's reaction::BankInstance
+	- Measures the memory held by the compartments of a hierarchy
 */
 
 #ifndef HIERCOMPARTMENT_H
@@ -76,6 +77,9 @@ public:
 	// Get reaction bank instantiated in this compartment
 	inline reaction::BankInstance *getMainReactionBank() const { return mainBank; }
 
+	// Add the bytes held by this compartment and all those inside it to mem
+	void addSubtreeMemoryUsage( CompartmentMemory &mem ) const throw();
+
 private:
 	// Orphans the compartment without removing it from the parent's queue
 	void orphanNoRelease();
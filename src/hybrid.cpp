@@ -0,0 +1,277 @@
+// See hybrid.h for a description of the contents of this file.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "hybrid.h"
+
+namespace sgns2 {
+
+const double HybridGroup::STEP_ACCURACY = 0.01;
+const double HybridGroup::STEP_STABILITY = 0.5;
+double HybridGroup::threshold = 1000.0;
+
+// ---------------------------------------------------------------------------
+HybridGroup::HybridGroup( Compartment *in ) throw()
+: ReactionGroup( in, reaction::Template::ENGINE_HYBRID )
+, lastT(0.0)
+, slowA(0.0)
+, integral(0.0)
+, target(0.0)
+, slowDue(false)
+{
+}
+
+// ---------------------------------------------------------------------------
+HybridGroup::~HybridGroup() throw() {
+	assert( members.empty() ); // All members must be destroyed first
+}
+
+// ---------------------------------------------------------------------------
+GroupMember *HybridGroup::newMember( const reaction::Template *tmplate ) {
+	// Members depend on their reactants exactly as NRM reactions do
+	Member *member = new Member( this, tmplate );
+	tmplate->addDependencies( &compartment, member );
+	member->setSlot( (uint)members.size() );
+	members.push_back( member );
+	return member;
+}
+
+// ---------------------------------------------------------------------------
+void HybridGroup::removeMember( GroupMember *member ) throw() {
+	Member *m = static_cast<Member*>(member);
+	m->getTemplate()->removeDependencies( &compartment, m );
+	Member *last = members.back();
+	last->setSlot( m->getSlot() );
+	members[m->getSlot()] = last;
+	members.pop_back();
+	if( m->touched )
+		touchedList.erase( std::find( touchedList.begin(), touchedList.end(), m ) );
+
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void HybridGroup::touch( GroupMember *member ) throw() {
+	Member *m = static_cast<Member*>(member);
+	if( !m->touched ) {
+		m->touched = true;
+		touchedList.push_back( m );
+	}
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void HybridGroup::begin() throw() {
+	ReactionGroup::begin();
+	lastT = getQueue()->getBaseTime();
+	slowA = 0.0;
+	integral = 0.0;
+	target = getRNG()->exponential();
+	slowDue = false;
+}
+
+// ---------------------------------------------------------------------------
+void HybridGroup::trigger() throw() {
+	double t = getQueue()->getBaseTime();
+	// The members touched by the step are recalculated by plan()
+	bool wasScheduled = updSelf;
+	updSelf = true;
+
+	advance( t );
+	if( slowDue ) {
+		Member *m = chooseSlow();
+		if( m )
+			m->getTemplate()->execute( &compartment );
+		integral = 0.0;
+		target = getRNG()->exponential();
+	}
+
+	plan( t );
+	updSelf = wasScheduled;
+}
+
+// ---------------------------------------------------------------------------
+void HybridGroup::update() throw() {
+	// Cut the step short at the change and plan a new one from the new
+	// populations. The integral of the slow propensity carries over.
+
+	double t = getQueue()->getUpdatedBaseTime();
+	updSelf = true;
+	advance( t );
+	plan( t );
+	updSelf = false;
+}
+
+// ---------------------------------------------------------------------------
+void HybridGroup::flushTouched() throw() {
+	for( size_t i = 0; i < touchedList.size(); i++ ) {
+		Member *m = touchedList[i];
+		m->touched = false;
+		m->a = m->c * m->getTemplate()->calcH( &compartment );
+	}
+	touchedList.clear();
+}
+
+// ---------------------------------------------------------------------------
+void HybridGroup::advance( double t ) throw() {
+	double h = t - lastT;
+	lastT = t;
+
+	// Pick up the changes that others made to the integrated species
+	for( size_t i = 0; i < fastSpecies.size(); i++ ) {
+		uint s = fastSpecies[i];
+		Population pop = compartment->getPopulation( s );
+		y[s] += (double)(pop - written[s]);
+		written[s] = pop;
+	}
+
+	if( h > 0.0 ) {
+		// Explicit Euler step with the propensities at the start of the step
+		for( size_t i = 0; i < members.size(); i++ ) {
+			Member *m = members[i];
+			if( !m->fast )
+				continue;
+			for( size_t j = 0; j < m->changes.size(); j++ )
+				y[m->changes[j].species] += m->changes[j].amount * m->a * h;
+		}
+		integral += slowA * h;
+	}
+
+	// Round the integrated populations into the compartment, which
+	// updates every reaction that depends on them
+	for( size_t i = 0; i < fastSpecies.size(); i++ ) {
+		uint s = fastSpecies[i];
+		if( y[s] < 0.0 )
+			y[s] = 0.0;
+		Population pop = (Population)floor( y[s] + 0.5 );
+		if( pop != written[s] ) {
+			compartment->modifyPopulation( s, pop - written[s] );
+			written[s] = pop;
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+void HybridGroup::plan( double t ) throw() {
+	flushTouched();
+
+	// A member is a candidate for integration if every species it changes
+	// has enough copies for a single firing to make little difference
+	for( size_t i = 0; i < members.size(); i++ ) {
+		Member *m = members[i];
+		m->fast = !m->delayed && m->a > 0.0 && !m->changes.empty();
+		for( size_t j = 0; j < m->changes.size() && m->fast; j++ ) {
+			if( (double)compartment->getPopulation( m->changes[j].species ) < threshold )
+				m->fast = false;
+		}
+	}
+	// Of those, only the ones which fire many times over a step are worth
+	// integrating
+	double h = stepSize();
+	for( size_t i = 0; i < members.size(); i++ ) {
+		Member *m = members[i];
+		if( m->fast && m->a * h < FAST_FIRINGS )
+			m->fast = false;
+	}
+	h = stepSize();
+
+	// Start integrating the newly fast species from their populations.
+	// Species that stay fast keep their fractional parts.
+	uint n = compartment->getChemicalCount();
+	if( y.size() < n ) {
+		y.resize( n, 0.0 );
+		written.resize( n, 0 );
+		integrated.resize( n, false );
+	}
+	for( size_t i = 0; i < fastSpecies.size(); i++ )
+		integrated[fastSpecies[i]] = false;
+	std::vector<uint> oldSpecies;
+	oldSpecies.swap( fastSpecies );
+	for( size_t i = 0; i < members.size(); i++ ) {
+		Member *m = members[i];
+		if( !m->fast )
+			continue;
+		for( size_t j = 0; j < m->changes.size(); j++ ) {
+			uint s = m->changes[j].species;
+			if( integrated[s] )
+				continue;
+			integrated[s] = true;
+			fastSpecies.push_back( s );
+			if( std::find( oldSpecies.begin(), oldSpecies.end(), s ) == oldSpecies.end() ) {
+				written[s] = compartment->getPopulation( s );
+				y[s] = (double)written[s];
+			}
+		}
+	}
+
+	// End the step early if the next slow member is due before
+	slowA = 0.0;
+	for( size_t i = 0; i < members.size(); i++ ) {
+		if( !members[i]->fast )
+			slowA += members[i]->a;
+	}
+	slowDue = false;
+	if( slowA > 0.0 ) {
+		double slowH = std::max( target - integral, 0.0 ) / slowA;
+		if( slowH <= h ) {
+			h = slowH;
+			slowDue = true;
+		}
+	}
+
+	totalA = slowA;
+	nextT = t + h;
+	schedule( nextT );
+}
+
+// ---------------------------------------------------------------------------
+double HybridGroup::stepSize() throw() {
+	uint n = compartment->getChemicalCount();
+	flux.assign( n, 0.0 );
+	outflow.assign( n, 0.0 );
+	for( size_t i = 0; i < members.size(); i++ ) {
+		Member *m = members[i];
+		if( !m->fast )
+			continue;
+		for( size_t j = 0; j < m->changes.size(); j++ ) {
+			const Change &ch = m->changes[j];
+			flux[ch.species] += ch.amount * m->a;
+			if( ch.amount < 0 )
+				outflow[ch.species] -= ch.amount * m->a;
+		}
+	}
+
+	// Bounding the gross outflow, rather than the net change, keeps the
+	// step stable near equilibrium
+	double h = std::numeric_limits<double>::infinity();
+	for( uint s = 0; s < n; s++ ) {
+		double x = std::max( (double)compartment->getPopulation( s ), 1.0 );
+		if( flux[s] != 0.0 )
+			h = std::min( h, STEP_ACCURACY * x / std::fabs( flux[s] ) );
+		if( outflow[s] > 0.0 )
+			h = std::min( h, STEP_STABILITY * x / outflow[s] );
+	}
+	return h;
+}
+
+// ---------------------------------------------------------------------------
+HybridGroup::Member *HybridGroup::chooseSlow() throw() {
+	// Linear search, as in the direct method
+	double r = getRNG()->rand_halfclosed01() * slowA;
+	Member *chosen = NULL;
+	for( size_t i = 0; i < members.size(); i++ ) {
+		Member *m = members[i];
+		if( m->fast || !(m->a > 0.0) )
+			continue;
+		chosen = m;
+		r -= m->a;
+		if( r < 0.0 )
+			break;
+	}
+	return chosen;
+}
+
+} // namespace sgns2
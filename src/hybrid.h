@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2011, Jason Lloyd-Price, Abhishekh Gupta, and Andre S. Ribeiro
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of the contributors may not be used to endorse or promote
+	  products derived from this software without specific prior written
+	  permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/* hybrid.h/cpp
+
+HybridGroup class contents:
+	- ReactionGroup implementing a hybrid of the direct method and a
+	  deterministic integration of the reaction rate equations (in the manner
+	  of Haseltine and Rawlings, 2002, and Salis and Kaznessis, 2005)
+	- Partitions its members into fast members, which fire often and only
+	  change species with many copies, and slow members, and repartitions
+	  after every step as the populations change
+	- Integrates the fast members with explicit Euler steps, keeping the
+	  populations that they change as real numbers and rounding them into the
+	  compartment after each step
+	- Fires the slow members when the integral of their total propensity,
+	  which changes with the integrated populations, reaches an exponentially
+	  distributed target
+*/
+
+#ifndef HYBRID_H
+#define HYBRID_H
+
+#include <vector>
+
+#include "reactiongroup.h"
+
+namespace sgns2 {
+
+// ===========================================================================
+class HybridGroup : public ReactionGroup {
+public:
+	explicit HybridGroup( Compartment *in ) throw();
+	virtual ~HybridGroup() throw();
+
+	// Manage the number of copies that every species changed by a reaction
+	// needs for the reaction to be integrated deterministically
+	// Only affects steps which are not yet planned
+	static inline double getThreshold() throw() { return threshold; }
+	static inline void setThreshold( double copies ) throw() { threshold = copies; }
+
+	// ReactionGroup interface
+	virtual GroupMember *newMember( const reaction::Template *tmplate );
+	virtual void removeMember( GroupMember *member ) throw();
+	virtual void touch( GroupMember *member ) throw();
+
+	// Draws the first slow firing target
+	virtual void begin() throw();
+	// Ends the current step, firing a slow member if it was due
+	virtual void trigger() throw();
+	// Integrates up to the current time and plans a new step
+	virtual void update() throw();
+
+private:
+	// The slot of a Member is its position in the members list
+	class Member : public GroupMember {
+	public:
+		Member( HybridGroup *group, const reaction::Template *tmplate ) throw()
+			: GroupMember( group, tmplate ), c(tmplate->getC()), a(0.0), fast(false), touched(false) {
+			delayed = collectChanges( tmplate, changes );
+		}
+		virtual ~Member() throw() {
+			getGroup()->removeMember( this );
+		}
+
+		double c; // The reaction's stochastic constant at instantiation
+		double a; // The member's propensity at the start of the step
+		std::vector<Change> changes; // Non-zero net changes, delayed products excluded
+		bool delayed; // Does the reaction have delayed products? (never fast)
+		bool fast; // Is the member integrated in the current step?
+		bool touched; // Set while the member is on the touched list
+	};
+
+	// A fast member must fire at least this many times over a step
+	static const int FAST_FIRINGS = 10;
+	// Largest relative change of a population in one step, as a fraction of
+	// the population (accuracy) and of its gross outflow (stability)
+	static const double STEP_ACCURACY;
+	static const double STEP_STABILITY;
+
+	// Recalculates the propensities of all touched members
+	void flushTouched() throw();
+	// Integrates the fast members from the end of the last step to time t,
+	// and adds the slow members' propensities over the step to the integral
+	void advance( double t ) throw();
+	// Partitions the members and plans the next step from time t
+	void plan( double t ) throw();
+	// Largest step for which the fast members keep the populations accurate
+	// and the integration stable
+	double stepSize() throw();
+	// Chooses a slow member in proportion to its propensity
+	Member *chooseSlow() throw();
+
+	// Copy threshold of fast members
+	static double threshold;
+
+	std::vector<Member*> members;
+	std::vector<Member*> touchedList; // Members touched since the last flush
+	// Integrated species: real-valued population, and the population last
+	// written into the compartment, to pick up the changes made by others
+	std::vector<double> y;
+	std::vector<Population> written;
+	std::vector<bool> integrated; // Is the species in fastSpecies?
+	std::vector<uint> fastSpecies; // Species changed by fast members
+	// Scratch space by species: net and gross outgoing rate of change
+	std::vector<double> flux, outflow;
+	double lastT; // End of the last step
+	double slowA; // Total propensity of the slow members over the step
+	double integral; // Integral of the slow propensity since the last slow firing
+	double target; // Value of the integral at which the next slow member fires
+	bool slowDue; // Does the planned step end with a slow firing?
+};
+
+} // namespace sgns2
+
+#endif // HYBRID_H
@@ -0,0 +1,135 @@
+// See luaexpression.h for a description of the contents of this file.
+
+#include "stdafx.h"
+
+#include <cmath>
+
+extern "C" {
+#include "lua.h"
+#include "lobject.h"
+#include "lopcodes.h"
+}
+
+#include "luaexpression.h"
+
+namespace sgns2 {
+
+// ---------------------------------------------------------------------------
+LuaExpression::LuaExpression() throw()
+: nParams(0)
+, nRegisters(0)
+, result(0)
+{
+}
+
+// ---------------------------------------------------------------------------
+LuaExpression::~LuaExpression() throw() {
+}
+
+// ---------------------------------------------------------------------------
+LuaExpression *LuaExpression::compile( lua_State *L, uint nArgs ) {
+	if( !lua_isfunction( L, -1 ) || lua_iscfunction( L, -1 ) )
+		return NULL;
+	const LClosure *cl = &static_cast<const Closure*>(lua_topointer( L, -1 ))->l;
+	const Proto *p = cl->p;
+	// Missing arguments would be nil, which arithmetic fails on
+	if( cl->nupvalues || p->is_vararg || p->numparams > nArgs || p->numparams > MAX_ARGS )
+		return NULL;
+	if( (uint)p->maxstacksize + (uint)p->sizek > MAX_VALUES )
+		return NULL;
+
+	LuaExpression *e = new LuaExpression();
+	e->nParams = p->numparams;
+	e->nRegisters = p->maxstacksize;
+	for( int i = 0; i < p->sizek; i++ )
+		e->constants.push_back( ttisnumber( &p->k[i] ) ? nvalue( &p->k[i] ) : 0.0 );
+
+	// Track which values hold numbers, so that nothing reads a nil
+	std::vector<bool> isNumber( e->nRegisters + e->constants.size(), false );
+	for( uint i = 0; i < e->nParams; i++ )
+		isNumber[i] = true;
+	for( int i = 0; i < p->sizek; i++ )
+		isNumber[e->nRegisters + i] = ttisnumber( &p->k[i] );
+
+	// Straight-line code only, so the first RETURN ends the function
+	for( int pc = 0; pc < p->sizecode; pc++ ) {
+		Instruction ins = p->code[pc];
+		Op op;
+		op.a = (uint16)GETARG_A(ins);
+		switch( GET_OPCODE(ins) ) {
+		case ::OP_MOVE:
+			op.code = EX_MOVE;
+			op.b = (uint16)GETARG_B(ins);
+			break;
+		case ::OP_LOADK:
+			op.code = EX_MOVE;
+			op.b = (uint16)(e->nRegisters + GETARG_Bx(ins));
+			break;
+		case ::OP_ADD: op.code = EX_ADD; break;
+		case ::OP_SUB: op.code = EX_SUB; break;
+		case ::OP_MUL: op.code = EX_MUL; break;
+		case ::OP_DIV: op.code = EX_DIV; break;
+		case ::OP_MOD: op.code = EX_MOD; break;
+		case ::OP_POW: op.code = EX_POW; break;
+		case ::OP_UNM:
+			op.code = EX_UNM;
+			op.b = (uint16)GETARG_B(ins);
+			break;
+		case ::OP_RETURN:
+			if( GETARG_B(ins) != 2 || !isNumber[GETARG_A(ins)] ) {
+				delete e;
+				return NULL;
+			}
+			e->result = GETARG_A(ins);
+			return e;
+		default:
+			delete e;
+			return NULL;
+		}
+		if( op.code != EX_MOVE && op.code != EX_UNM ) {
+			int b = GETARG_B(ins), c = GETARG_C(ins);
+			op.b = (uint16)(ISK(b) ? e->nRegisters + INDEXK(b) : b);
+			op.c = (uint16)(ISK(c) ? e->nRegisters + INDEXK(c) : c);
+			if( !isNumber[op.c] ) {
+				delete e;
+				return NULL;
+			}
+		}
+		if( !isNumber[op.b] ) {
+			delete e;
+			return NULL;
+		}
+		isNumber[op.a] = true;
+		e->program.push_back( op );
+	}
+
+	delete e;
+	return NULL;
+}
+
+// ---------------------------------------------------------------------------
+double LuaExpression::evaluate( const double *args ) const throw() {
+	double v[MAX_VALUES];
+	for( uint i = 0; i < nParams; i++ )
+		v[i] = args[i];
+	for( size_t i = 0; i < constants.size(); i++ )
+		v[nRegisters + i] = constants[i];
+
+	// The same operations as luai_num* in luaconf.h
+	for( size_t i = 0; i < program.size(); i++ ) {
+		const Op &op = program[i];
+		switch( op.code ) {
+		case EX_MOVE: v[op.a] = v[op.b]; break;
+		case EX_ADD: v[op.a] = v[op.b] + v[op.c]; break;
+		case EX_SUB: v[op.a] = v[op.b] - v[op.c]; break;
+		case EX_MUL: v[op.a] = v[op.b] * v[op.c]; break;
+		case EX_DIV: v[op.a] = v[op.b] / v[op.c]; break;
+		case EX_MOD: v[op.a] = v[op.b] - floor( v[op.b] / v[op.c] ) * v[op.c]; break;
+		case EX_POW: v[op.a] = pow( v[op.b], v[op.c] ); break;
+		case EX_UNM: v[op.a] = -v[op.b]; break;
+		}
+	}
+	return v[result];
+}
+
+} // namespace sgns2
@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2011, Jason Lloyd-Price, Abhishekh Gupta, and Andre S. Ribeiro
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of the contributors may not be used to endorse or promote
+	  products derived from this software without specific prior written
+	  permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* luaexpression.h/cpp
+
+LuaExpression class contents:
+	- A Lua function which is pure arithmetic on its arguments, translated
+	  from its Lua bytecode into a small register program
+	- Evaluates the function without the lua_State, doing the same floating
+	  point operations as Lua
+*/
+
+#ifndef LUAEXPRESSION_H
+#define LUAEXPRESSION_H
+
+#include <vector>
+
+#include "simtypes.h"
+
+struct lua_State;
+
+namespace sgns2 {
+
+// ===========================================================================
+class LuaExpression {
+public:
+	~LuaExpression() throw();
+
+	// Translates the Lua function on top of the stack, which will be called
+	// with nArgs arguments. Returns NULL unless the function only does
+	// arithmetic on its arguments and on numeric constants, without
+	// branches, upvalues, globals or calls, and returns a single number.
+	static LuaExpression *compile( lua_State *L, uint nArgs );
+
+	// The most arguments a translated function may read
+	static const uint MAX_ARGS = 32;
+	// Number of leading arguments that the function reads
+	inline uint getArgCount() const { return nParams; }
+	// Evaluates the function on the arguments
+	double evaluate( const double *args ) const throw();
+
+private:
+	LuaExpression() throw();
+
+	enum Operation {
+		EX_MOVE,
+		EX_ADD,
+		EX_SUB,
+		EX_MUL,
+		EX_DIV,
+		EX_MOD,
+		EX_POW,
+		EX_UNM
+	};
+	// One step of the program. Operands index the value array, in which
+	// the registers are followed by the constants.
+	struct Op {
+		unsigned char code;
+		uint16 a, b, c;
+	};
+	// The largest value array evaluated on the stack
+	static const uint MAX_VALUES = 512;
+
+	std::vector<Op> program;
+	std::vector<double> constants;
+	uint nParams;
+	uint nRegisters;
+	uint result;
+};
+
+} // namespace sgns2
+
+#endif // LUAEXPRESSION_H
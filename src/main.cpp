@@ -46,6 +46,7 @@ Contents:
 
 #include "platform.h"
 #include "simulationloader.h"
+#include "reactiongroup.h"
 #include "multithread.h"
 #include "simulationsampler.h"
 #include "samplertarget.h"
@@ -57,6 +58,8 @@ Contents:
 
 // Performance output information
 sgns2::uint64 g_stepCount = 0;
+sgns2::uint64 g_tableHits = 0, g_tableMisses = 0;
+sgns2::CompartmentMemory g_memory; // Compartments at the end of the first simulation
 clock_t g_startClock;
 clock_t g_initClock;
 clock_t g_finishClock;
@@ -96,6 +99,9 @@ static void printHelp( const char *cmd ) {
 	std::cout << "                     Use -o- to output to stdout" << std::endl;
 	std::cout << "  -f<format>         Equivalent to --output_format <format>" << std::endl;
 	std::cout << "                     Formats: csv (default), tsv, bin32, bin64, none" << std::endl;
+	std::cout << "  -queue=<layout>    Equivalent to --event_queue <layout>" << std::endl;
+	std::cout << "                     Layouts: binary (default), 4ary, tournament," << std::endl;
+	std::cout << "                     soa (experimental)" << std::endl;
 	std::cout << "  !<lua-code>        Executes the given Lua code immediately" << std::endl;
 	std::cout << "  -t[<start>-]<stop>[:<interval>]" << std::endl;
 	std::cout << "                     Set the simulation time to <start> (or 0 if <start> is" << std::endl;
@@ -274,6 +280,22 @@ static void parseCommandLine( int argc, const char **argv, sgns2::SimulationLoad
 					}
 					ld->getParser()->parse( here, "output_format", src );
 				} break;
+				case 'q': {
+					// -queue=<layout>
+					const char *src = argv[arg] + 2;
+					if( 0 == strncmp( src, "ueue", 4 ) )
+						src += 4;
+					if( *src == '=' )
+						src++;
+					if( !*src ) {
+						if( ++arg >= argc ) {
+							std::cerr << here << ": Expected event queue layout" << std::endl;
+							exit(1);
+						}
+						src = argv[arg];
+					}
+					ld->getParser()->parse( here, "event_queue", src );
+				} break;
 				case '?':
 					printHelp( argv[0] );
 					exit(0);
@@ -427,6 +449,8 @@ static sgns2::uint64 runSim( sgns2::SimulationLoader *ld, SimulationSampler *sam
 	}
 
 	sgns2::uint64 steps = sim->getStepCount();
+	if( (idx == 0 || idx == (unsigned)-1) && ld->shouldShow( sgns2::SimulationLoader::SHOW_PERFORMANCE ) )
+		env->addSubtreeMemoryUsage( g_memory );
 
 	delete env; // Frees all memory associated with the simulation
 	delete sim;
@@ -548,6 +572,8 @@ static void runBatchMT( BatchMTContext *ctx ) {
 			batchNo = ctx->batchIndex++;
 		} else {
 			// Batches done
+			g_tableHits += sgns2::RateTable::takeHitCount();
+			g_tableMisses += sgns2::RateTable::takeMissCount();
 			mt::unlock( ctx->batchMutex );
 			mt::v( ctx->endSema );
 			return;
@@ -669,6 +695,26 @@ void showPerformance( sgns2::SimulationLoader *ld ) {
 	std::cout << "    Run time:       " << runTime << " s" << std::endl;
 	unsigned stepsPerSec = (unsigned)floor( g_stepCount / runTime );
 	std::cout << "    Steps / sec:    " << stepsPerSec << std::endl;
+	std::cout << "    Event queue:    " << sgns2::EventQueue::getBackendName( sgns2::EventQueue::getDefaultBackend() ) << std::endl;
+	std::cout << "    Dispatch:       " << (sgns2::EventStream::isTaggedDispatch() ? "tagged" : "virtual") << std::endl;
+	std::cout << "    Engine:         " << sgns2::ReactionGroup::getEngineName( ld->getEngine() );
+	if( ld->getEngine() != sgns2::reaction::Template::ENGINE_NRM )
+		std::cout << " (" << ld->getEngineReactionCount() << " of " << ld->getReactionCount() << " reactions, others NRM)";
+	std::cout << std::endl;
+	if( ld->getRateTableCount() ) {
+		// Runs outside of the batch threads were counted in this one
+		g_tableHits += sgns2::RateTable::takeHitCount();
+		g_tableMisses += sgns2::RateTable::takeMissCount();
+		std::cout << "    Rate tables:    " << ld->getRateTableCount() << ", serving " << g_tableHits
+			<< " of " << g_tableHits + g_tableMisses << " evaluations" << std::endl;
+	}
+	if( g_memory.count ) {
+		size_t n = g_memory.count;
+		std::cout << "    Compartments:   " << n << ", " << g_memory.getTotal() / n << " bytes each" << std::endl;
+		std::cout << "      (objects " << g_memory.objects / n << ", populations " << g_memory.populations / n
+			<< ", dependencies " << g_memory.dependencies / n << ", queues " << g_memory.queues / n
+			<< ", wait lists " << g_memory.waitLists / n << ", reactions " << g_memory.reactions / n << ")" << std::endl;
+	}
 #ifdef _WIN32
 	PROCESS_MEMORY_COUNTERS mem;
 	if( GetProcessMemoryInfo( GetCurrentProcess(), &mem, sizeof( mem ) ) ) {
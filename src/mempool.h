@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 MemoryPool class contents:
 	- Memory pool for objects we burn through quickly
+	- Reports the memory it holds
 
 */
 
@@ -91,6 +92,13 @@ public:
 		freeObjects.push_back (obj);
 	}
 
+	// ----------------------------------------------------------------------------
+	size_t getMemoryUsage() const {
+		// Bytes held by the pool, whether its objects are in use or not
+		return pools.size() * allocIncrement * sizeof(T)
+			+ (pools.capacity() + freeObjects.capacity()) * sizeof(T*);
+	}
+
 private:
 	std::vector<T*> pools;
 	std::vector<T*> freeObjects;
@@ -0,0 +1,180 @@
+// See modelcompiler.h for a description of the contents of this file.
+
+#include "stdafx.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "platform.h"
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#include "compartment.h"
+#include "modelcompiler.h"
+
+namespace sgns2 {
+
+using reaction::Reactant;
+using reaction::Template;
+
+// ---------------------------------------------------------------------------
+ModelCompiler::ModelCompiler( const std::string &cacheDir )
+: cacheDir(cacheDir)
+, cached(false)
+{
+}
+
+// ---------------------------------------------------------------------------
+ModelCompiler::~ModelCompiler() {
+}
+
+// ---------------------------------------------------------------------------
+bool ModelCompiler::add( Template *tmplate ) {
+	if( !tmplate->hasDefaultHEvaluator() )
+		return false;
+
+	// Multiply in the factors in the same order as the default H-function
+	std::string body;
+	for( Reactant *r = tmplate->getFirstReactant(); r; r = r->getNext() ) {
+		std::ostringstream pop;
+		pop << "POP( " << r->getCompartmentIndex() << ", " << r->getIndex() << " )";
+		body.append( "\t" );
+		if( !BasicRateFunction::writeProduct( r->getRateFunction(), pop.str().c_str(), body ) )
+			return false;
+		body.append( "\n" );
+	}
+
+	std::ostringstream fn;
+	fn << "double sgns2_h_" << templates.size() << "( void **ctx, void * ) {\n"
+		<< "\tdouble h = 1.0;\n" << body << "\treturn h;\n}\n\n";
+	code.append( fn.str() );
+	templates.push_back( tmplate );
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+std::string ModelCompiler::preamble() const {
+	size_t arrayOffset, stride, popOffset, wideOffset;
+	Compartment::getPopulationLayout( arrayOffset, stride, popOffset, wideOffset );
+
+	std::ostringstream out;
+	out << "// H-functions of an SGNS2 model, generated by SGNS2. Do not edit.\n\n"
+		<< "#include <algorithm>\n#include <cmath>\n\n"
+		<< "typedef " << (sizeof(Population) == sizeof(int) ? "int" : "long long") << " Population;\n"
+		<< "typedef " << (stride == sizeof(int) ? "int" : "long long") << " StoredPopulation;\n\n"
+		<< "// Population of species i in compartment c of the reaction's context\n"
+		<< "#define STORED( c, i ) (*(const StoredPopulation*)(*(const char *const *)((const char*)ctx[c] + "
+		<< arrayOffset << ") + (i) * " << stride << " + " << popOffset << "))\n";
+	if( wideOffset == (size_t)-1 ) {
+		out << "#define POP( c, i ) ((Population)STORED( c, i ))\n\n";
+	} else {
+		out << "#define WIDE( c ) (*(const Population *const *)((const char*)ctx[c] + " << wideOffset << "))\n"
+			<< "#define POP( c, i ) (WIDE( c ) ? WIDE( c )[i] : (Population)STORED( c, i ))\n\n";
+	}
+	out << "extern \"C\" {\n\n";
+	return out.str();
+}
+
+// ---------------------------------------------------------------------------
+std::string ModelCompiler::hash( const std::string &text ) {
+	// The constants are built from halves, as C++98 has no 64-bit literals
+	uint64 h = ((uint64)0xcbf29ce4 << 32) | 0x84222325;
+	for( size_t i = 0; i < text.size(); i++ ) {
+		h ^= (unsigned char)text[i];
+		h *= ((uint64)0x100 << 32) | 0x1b3;
+	}
+	char buf[17];
+	for( int i = 15; i >= 0; i-- ) {
+		buf[i] = "0123456789abcdef"[h & 15];
+		h >>= 4;
+	}
+	buf[16] = '\0';
+	return buf;
+}
+
+// ---------------------------------------------------------------------------
+bool ModelCompiler::build( std::string &error ) {
+#ifdef _WIN32
+	error = "Native compilation of models is not supported on this platform";
+	return false;
+#else
+	if( cacheDir.find( '\'' ) != std::string::npos ) {
+		error = "The model cache directory may not contain quotes";
+		return false;
+	}
+
+	const char *cxx = getenv( "CXX" );
+	if( !cxx || !*cxx )
+		cxx = "c++";
+	const char *flags = "-O2 -shared -fPIC";
+	std::string source = preamble() + code + "} // extern \"C\"\n";
+	std::string base = cacheDir + "/sgns2-model-" + hash( source + cxx + flags );
+	std::string so = base + ".so";
+
+	cached = access( so.c_str(), R_OK ) == 0;
+	if( !cached ) {
+		// Build under names of our own, so that concurrent runs of the same
+		// model never see each other's half-written files
+		std::ostringstream tmp;
+		tmp << base << "." << getpid();
+		std::string tmpSrc = tmp.str() + ".cpp", tmpSo = tmp.str() + ".so", log = tmp.str() + ".log";
+		{
+			std::ofstream out( tmpSrc.c_str() );
+			out << source;
+			if( !out ) {
+				error = "Could not write " + tmpSrc;
+				return false;
+			}
+		}
+
+		std::string cmd = std::string( cxx ) + " " + flags + " -o '" + tmpSo + "' '" + tmpSrc + "' > '" + log + "' 2>&1";
+		if( system( cmd.c_str() ) != 0 ) {
+			error = "Compilation failed, see " + log;
+			remove( tmpSo.c_str() );
+			return false;
+		}
+		remove( log.c_str() );
+		if( rename( tmpSo.c_str(), so.c_str() ) != 0 ) {
+			error = "Could not write " + so;
+			remove( tmpSo.c_str() );
+			return false;
+		}
+		rename( tmpSrc.c_str(), (base + ".cpp").c_str() );
+	}
+
+	void *module = dlopen( so.c_str(), RTLD_NOW | RTLD_LOCAL );
+	if( !module ) {
+		error = dlerror();
+		return false;
+	}
+
+	// Look every function up before hooking any in
+	std::vector<Template::HEvaluator> fns( templates.size() );
+	for( size_t i = 0; i < templates.size(); i++ ) {
+		std::ostringstream name;
+		name << "sgns2_h_" << i;
+		union {
+			void *p;
+			Template::HEvaluator fn;
+		} sym;
+		sym.p = dlsym( module, name.str().c_str() );
+		if( !sym.p ) {
+			error = so + " does not define " + name.str();
+			dlclose( module );
+			return false;
+		}
+		fns[i] = sym.fn;
+	}
+	for( size_t i = 0; i < templates.size(); i++ )
+		templates[i]->setNativeHEvaluator( fns[i] );
+
+	// The module stays loaded for as long as the process runs, since the
+	// reactions now point into it
+	return true;
+#endif
+}
+
+} // namespace sgns2
@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2011, Jason Lloyd-Price, Abhishekh Gupta, and Andre S. Ribeiro
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of the contributors may not be used to endorse or promote
+	  products derived from this software without specific prior written
+	  permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* modelcompiler.h/cpp
+
+ModelCompiler class contents:
+	- Generates C++ code for the default H-functions of a model's reactions,
+	  doing the same floating point operations as the RateFunctions
+	- Builds it into a shared object with the system's C++ compiler and
+	  loads it, caching the shared object on disk under a hash of the code
+	- Hooks the compiled functions into the reactions as native H-evaluators
+*/
+
+#ifndef MODELCOMPILER_H
+#define MODELCOMPILER_H
+
+#include <string>
+#include <vector>
+
+#include "reaction.h"
+
+namespace sgns2 {
+
+// ===========================================================================
+class ModelCompiler {
+public:
+	// Shared objects are kept in, and looked up in, cacheDir
+	explicit ModelCompiler( const std::string &cacheDir );
+	~ModelCompiler();
+
+	// Adds the reaction to the code to compile. Returns false if it has a
+	// special H-function, or a rate function with no C++ equivalent.
+	bool add( reaction::Template *tmplate );
+	// Number of reactions added
+	inline uint getReactionCount() const { return (uint)templates.size(); }
+
+	// Builds the shared object unless it is cached, loads it and hooks the
+	// compiled H-functions into the reactions. On failure, returns false
+	// with the reason in error and leaves the reactions untouched.
+	bool build( std::string &error );
+	// Was the shared object found in the cache by the last build?
+	inline bool wasCached() const { return cached; }
+
+private:
+	std::string cacheDir;
+	// The generated code for each reaction's H-function
+	std::string code;
+	// The reactions, in the order of their functions
+	std::vector<reaction::Template*> templates;
+	bool cached;
+
+	// Writes the code shared by all the functions
+	std::string preamble() const;
+	// 64-bit FNV-1a hash of the text, in hexadecimal
+	static std::string hash( const std::string &text );
+};
+
+} // namespace sgns2
+
+#endif // MODELCOMPILER_H
@@ -752,7 +752,7 @@ void Parser::readIdReaction() {
 		if( 0 == strcmp( hFuncName, "lua" ) ) {
 			if( nParams != 1 || !lua_isfunction( L, 1 ) )
 				error( "lua h-function expects one function as a parameter" );
-			params[0] = (double)luaL_ref( L, 1 );
+			params[0] = (double)luaL_ref( L, LUA_REGISTRYINDEX );
 		} else {
 			for( uint i = 0; i < nParams; i++ ) {
 				if( !lua_isnumber( L, i + 1 ) )
@@ -0,0 +1,316 @@
+// See partialpropensity.h for a description of the contents of this file.
+
+#include "stdafx.h"
+
+#include <algorithm>
+
+#include "partialpropensity.h"
+
+namespace sgns2 {
+
+using reaction::Reactant;
+
+// ---------------------------------------------------------------------------
+PartialPropensityGroup::Member::Member( PartialPropensityGroup *group, const reaction::Template *tmplate ) throw()
+: GroupMember( group, tmplate )
+, c(tmplate->getC())
+, pi(0.0)
+, rowReactant(NULL)
+, rowOrder(0)
+, row(NO_ROW)
+, inRow(false)
+, touched(false)
+{
+	// Factor out the first first-order reactant, so that the partial
+	// propensity does not depend on the row species, or failing that the
+	// first higher-order one. Zeroth-order reactions get no row species.
+	for( Reactant *r = tmplate->getFirstReactant(); r; r = r->getNext() ) {
+		int order = BasicRateFunction::getGilHOrder( r->getRateFunction() );
+		if( order > 0 && (!rowReactant || (rowOrder > 1 && order == 1)) ) {
+			rowReactant = r;
+			rowOrder = order;
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+PartialPropensityGroup::PartialPropensityGroup( Compartment *in ) throw()
+: ReactionGroup( in, reaction::Template::ENGINE_PDM )
+, memberCount(0)
+, zerothRow(NO_ROW)
+, tree(2, 0.0)
+, treeCapacity(1)
+{
+}
+
+// ---------------------------------------------------------------------------
+PartialPropensityGroup::~PartialPropensityGroup() throw() {
+	assert( memberCount == 0 ); // All members must be destroyed first
+}
+
+// ---------------------------------------------------------------------------
+bool PartialPropensityGroup::isMassAction( const reaction::Template *tmplate ) throw() {
+	// The propensity must be c times a product of GilH functions
+	if( !tmplate->hasDefaultHEvaluator() )
+		return false;
+	for( Reactant *r = tmplate->getFirstReactant(); r; r = r->getNext() ) {
+		if( BasicRateFunction::getGilHOrder( r->getRateFunction() ) < 0 )
+			return false;
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+GroupMember *PartialPropensityGroup::newMember( const reaction::Template *tmplate ) {
+	Member *m = new Member( this, tmplate );
+	m->row = getRow( m->rowReactant ? (uint)m->rowReactant->getIndex() : NO_SPECIES );
+
+	// Depend on every species in the propensity. All but a first-order row
+	// species also go into the partial propensity.
+	for( Reactant *r = tmplate->getFirstReactant(); r; r = r->getNext() ) {
+		if( BasicRateFunction::getGilHOrder( r->getRateFunction() ) == 0 )
+			continue;
+		uint index = (uint)r->getIndex();
+		watch( index );
+		if( r != m->rowReactant || m->rowOrder > 1 ) {
+			std::vector<Member*> &partnerOf = species[index].partnerOf;
+			if( partnerOf.empty() || partnerOf.back() != m )
+				partnerOf.push_back( m );
+		}
+	}
+
+	memberCount++;
+	return m;
+}
+
+// ---------------------------------------------------------------------------
+void PartialPropensityGroup::removeMember( GroupMember *member ) throw() {
+	Member *m = static_cast<Member*>(member);
+
+	if( m->inRow ) {
+		// Swap the last member of the row into the removed member's place
+		Row &row = rows[m->row];
+		Member *last = row.members.back();
+		last->setSlot( m->getSlot() );
+		row.members[m->getSlot()] = last;
+		row.members.pop_back();
+		row.lambda = row.members.empty() ? 0.0 : row.lambda - m->pi;
+		markDirty( m->row );
+	}
+
+	for( Reactant *r = m->getTemplate()->getFirstReactant(); r; r = r->getNext() ) {
+		if( BasicRateFunction::getGilHOrder( r->getRateFunction() ) == 0 )
+			continue;
+		uint index = (uint)r->getIndex();
+		std::vector<Member*> &partnerOf = species[index].partnerOf;
+		partnerOf.erase( std::remove( partnerOf.begin(), partnerOf.end(), m ), partnerOf.end() );
+		unwatch( index );
+	}
+
+	if( m->touched )
+		touchedList.erase( std::find( touchedList.begin(), touchedList.end(), m ) );
+	memberCount--;
+
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void PartialPropensityGroup::touch( GroupMember *member ) throw() {
+	// Only called by begin(); the members do not depend on species themselves
+	Member *m = static_cast<Member*>(member);
+	if( !m->touched ) {
+		m->touched = true;
+		touchedList.push_back( m );
+	}
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void PartialPropensityGroup::popUpdate( uint index ) throw() {
+	Species &s = species[index];
+	if( !s.changed ) {
+		s.changed = true;
+		changedSpecies.push_back( index );
+	}
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void PartialPropensityGroup::trigger() throw() {
+	// Fire a member chosen in proportion to its propensity
+
+	double t = getQueue()->getBaseTime();
+	RNG::RNG *rng = getRNG();
+	// The changes made by the reaction are applied right here
+	bool wasScheduled = updSelf;
+	updSelf = true;
+
+	if( tree[1] > 0.0 ) {
+		// Choose the row by descending the sum tree
+		double r = rng->rand_halfclosed01() * tree[1];
+		uint node = 1;
+		while( node < treeCapacity ) {
+			node <<= 1;
+			if( r >= tree[node] && tree[node + 1] > 0.0 ) {
+				r -= tree[node];
+				node++;
+			}
+		}
+
+		// Then the member within the row, by partial propensity
+		Row &row = rows[node - treeCapacity];
+		if( row.species != NO_SPECIES )
+			r /= (double)compartment->getPopulation( row.species );
+		Member *chosen = NULL;
+		for( size_t i = 0; i < row.members.size(); i++ ) {
+			Member *m = row.members[i];
+			if( m->pi > 0.0 ) {
+				chosen = m;
+				r -= m->pi;
+				if( r < 0.0 )
+					break;
+			}
+		}
+
+		if( chosen )
+			chosen->getTemplate()->execute( &compartment );
+	}
+
+	flush();
+	reschedule( t, tree[1], true );
+	updSelf = wasScheduled;
+}
+
+// ---------------------------------------------------------------------------
+void PartialPropensityGroup::update() throw() {
+	updSelf = false;
+	flush();
+	reschedule( getQueue()->getUpdatedBaseTime(), tree[1], false );
+}
+
+// ---------------------------------------------------------------------------
+void PartialPropensityGroup::flush() throw() {
+	// Recalculates everything that has changed since the last flush
+
+	// Changed species invalidate their row and the partial propensities
+	// they are part of
+	for( size_t i = 0; i < changedSpecies.size(); i++ ) {
+		Species &s = species[changedSpecies[i]];
+		s.changed = false;
+		for( size_t j = 0; j < s.partnerOf.size(); j++ ) {
+			Member *m = s.partnerOf[j];
+			if( !m->touched ) {
+				m->touched = true;
+				touchedList.push_back( m );
+			}
+		}
+		if( s.row != NO_ROW )
+			markDirty( s.row );
+	}
+	changedSpecies.clear();
+
+	for( size_t i = 0; i < touchedList.size(); i++ ) {
+		Member *m = touchedList[i];
+		m->touched = false;
+		double pi = calcPartial( m );
+		Row &row = rows[m->row];
+		if( m->inRow ) {
+			row.lambda += pi - m->pi;
+			row.incrementalUpdates++;
+		} else {
+			m->inRow = true;
+			m->setSlot( (uint)row.members.size() );
+			row.members.push_back( m );
+			row.lambda += pi;
+		}
+		m->pi = pi;
+		markDirty( m->row );
+	}
+	touchedList.clear();
+
+	for( size_t i = 0; i < dirtyRows.size(); i++ ) {
+		Row &row = rows[dirtyRows[i]];
+		row.dirty = false;
+		if( row.incrementalUpdates > row.members.size() + 64 ) {
+			// Keep the rounding errors of the incremental updates in check
+			row.lambda = 0.0;
+			for( size_t j = 0; j < row.members.size(); j++ )
+				row.lambda += row.members[j]->pi;
+			row.incrementalUpdates = 0;
+		}
+		double x = row.species == NO_SPECIES ? 1.0 : (double)compartment->getPopulation( row.species );
+		setRowPropensity( dirtyRows[i], x * row.lambda );
+	}
+	dirtyRows.clear();
+}
+
+// ---------------------------------------------------------------------------
+double PartialPropensityGroup::calcPartial( Member *m ) throw() {
+	// The propensity divided by the population of the row species
+
+	double pi = m->c;
+	for( Reactant *r = m->getTemplate()->getFirstReactant(); r; r = r->getNext() ) {
+		if( r != m->rowReactant ) {
+			pi *= r->evaluate( &compartment );
+		} else {
+			// (X choose N) / X
+			double x = (double)r->getPopulationIn( &compartment );
+			for( int i = 1; i < m->rowOrder; i++ )
+				pi *= (x - i) / (i + 1);
+		}
+	}
+	return pi;
+}
+
+// ---------------------------------------------------------------------------
+void PartialPropensityGroup::setRowPropensity( uint row, double a ) throw() {
+	uint node = treeCapacity + row;
+	tree[node] = a > 0.0 ? a : 0.0;
+	while( node > 1 ) {
+		node >>= 1;
+		tree[node] = tree[2 * node] + tree[2 * node + 1];
+	}
+}
+
+// ---------------------------------------------------------------------------
+PartialPropensityGroup::Species &PartialPropensityGroup::getSpecies( uint index ) {
+	if( index >= species.size() )
+		species.resize( std::max( (uint)compartment->getChemicalCount(), index + 1 ) );
+	return species[index];
+}
+
+// ---------------------------------------------------------------------------
+uint PartialPropensityGroup::getRow( uint index ) {
+	uint *row = index == NO_SPECIES ? &zerothRow : &getSpecies( index ).row;
+	if( *row != NO_ROW )
+		return *row;
+
+	*row = (uint)rows.size();
+	rows.push_back( Row( index ) );
+	if( rows.size() > treeCapacity ) {
+		// Double the sum tree
+		uint capacity = treeCapacity * 2;
+		std::vector<double> newTree( 2 * capacity, 0.0 );
+		for( uint i = 0; i < treeCapacity; i++ )
+			newTree[capacity + i] = tree[treeCapacity + i];
+		for( uint node = capacity - 1; node >= 1; node-- )
+			newTree[node] = newTree[2 * node] + newTree[2 * node + 1];
+		tree.swap( newTree );
+		treeCapacity = capacity;
+	}
+	return *row;
+}
+
+// ---------------------------------------------------------------------------
+void PartialPropensityGroup::watch( uint index ) {
+	if( getSpecies( index ).watchers++ == 0 )
+		compartment->addDependency( index, this );
+}
+
+// ---------------------------------------------------------------------------
+void PartialPropensityGroup::unwatch( uint index ) {
+	if( --species[index].watchers == 0 )
+		compartment->removeDependency( index, this );
+}
+
+} // namespace sgns2
@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2011, Jason Lloyd-Price, Abhishekh Gupta, and Andre S. Ribeiro
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of the contributors may not be used to endorse or promote
+	  products derived from this software without specific prior written
+	  permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/* partialpropensity.h/cpp
+
+PartialPropensityGroup class contents:
+	- ReactionGroup implementing the partial-propensity direct method
+	  (Ramaswamy, Gonzalez-Segredo and Sbalzarini, 2009) for mass-action
+	  reactions
+	- Factors the propensity of each member as x * pi, where x is the
+	  population of one of its reactant species (its row) and the partial
+	  propensity pi depends only on the other reactants
+	- Depends on species rather than on reactions, so that a population change
+	  costs O(1) for its row plus one update for each member whose partial
+	  propensity involves the species, independently of the row's size
+	- Keeps the row propensities in a sum tree for O(log rows) selection
+*/
+
+#ifndef PARTIALPROPENSITY_H
+#define PARTIALPROPENSITY_H
+
+#include <vector>
+
+#include "reactiongroup.h"
+
+namespace sgns2 {
+
+// ===========================================================================
+class PartialPropensityGroup : public ReactionGroup {
+public:
+	explicit PartialPropensityGroup( Compartment *in ) throw();
+	virtual ~PartialPropensityGroup() throw();
+
+	// Can the reaction be factored into partial propensities?
+	static bool isMassAction( const reaction::Template *tmplate ) throw();
+
+	// ReactionGroup interface
+	virtual GroupMember *newMember( const reaction::Template *tmplate );
+	virtual void removeMember( GroupMember *member ) throw();
+	virtual void touch( GroupMember *member ) throw();
+
+	// Fires one of the members
+	virtual void trigger() throw();
+	// A species that the group depends on changed
+	virtual void popUpdate( uint species ) throw();
+	// Recalculates the changed partial propensities and rows
+	virtual void update() throw();
+
+private:
+	// The slot of a Member is its position within its row
+	class Member : public GroupMember {
+	public:
+		Member( PartialPropensityGroup *group, const reaction::Template *tmplate ) throw();
+		virtual ~Member() throw() {
+			getGroup()->removeMember( this );
+		}
+
+		double c; // The reaction's stochastic constant at instantiation
+		double pi; // The member's partial propensity
+		reaction::Reactant *rowReactant; // The factored-out reactant, or NULL
+		int rowOrder; // Order of the row reactant in the reaction
+		uint row; // The member's row
+		bool inRow; // Has the member been added to its row yet?
+		bool touched; // Set while the member is on the touched list
+	};
+	struct Row {
+		Row( uint species ) : species(species), lambda(0.0), incrementalUpdates(0), dirty(false) { }
+		std::vector<Member*> members; // Members factored by this row's species
+		uint species; // Row species (NO_SPECIES for zeroth-order reactions)
+		double lambda; // Sum of the members' partial propensities
+		uint incrementalUpdates; // Number of updates to lambda since it was resummed
+		bool dirty; // Set while the row is on the dirty list
+	};
+	struct Species {
+		Species() : row(NO_ROW), watchers(0), changed(false) { }
+		std::vector<Member*> partnerOf; // Members whose pi depends on the species
+		uint row; // The row of the species (NO_ROW if none)
+		uint watchers; // Number of members depending on the species
+		bool changed; // Set while the species is on the changed list
+	};
+	static const uint NO_SPECIES = (uint)-1;
+	static const uint NO_ROW = (uint)-1;
+
+	// Get the species, growing the table if necessary
+	Species &getSpecies( uint index );
+	// Get the row of a species, creating it if necessary
+	uint getRow( uint species );
+	// Depend on a species
+	void watch( uint species );
+	void unwatch( uint species );
+	// Calculates the partial propensity of a member
+	double calcPartial( Member *m ) throw();
+	// Puts a row on the dirty list
+	inline void markDirty( uint row ) throw() {
+		if( !rows[row].dirty ) {
+			rows[row].dirty = true;
+			dirtyRows.push_back( row );
+		}
+	}
+	// Recalculates everything that has changed since the last flush
+	void flush() throw();
+	// Sets the propensity of a row in the sum tree
+	void setRowPropensity( uint row, double a ) throw();
+
+	uint memberCount; // Number of members in the group
+	uint zerothRow; // Row of the zeroth-order members (NO_ROW if none)
+	std::vector<Species> species; // By species index in the compartment
+	std::vector<Row> rows;
+	std::vector<uint> changedSpecies;
+	std::vector<Member*> touchedList;
+	std::vector<uint> dirtyRows;
+	// Sum tree over the row propensities. The propensity of row i is at
+	// tree[treeCapacity + i], and each node is the sum of its two children.
+	std::vector<double> tree;
+	uint treeCapacity;
+};
+
+} // namespace sgns2
+
+#endif // PARTIALPROPENSITY_H
@@ -0,0 +1,354 @@
+// See quasiequilibrium.h for a description of the contents of this file.
+
+#include "stdafx.h"
+
+#include <cmath>
+
+#include "quasiequilibrium.h"
+
+namespace sgns2 {
+
+using reaction::Reactant;
+using reaction::Product;
+
+// Weights below this fraction of the sum so far end the sums over the
+// distribution of a pair
+static const double NEGLIGIBLE_WEIGHT = 1e-15;
+
+// ---------------------------------------------------------------------------
+// C(n,k) as a double, 0 if n < k
+static inline double choose( Population n, uint k ) {
+	double c = 1.0;
+	for( uint j = 0; j < k; j++ )
+		c *= (double)(n - (Population)j) / (j + 1);
+	return n < (Population)k ? 0.0 : c;
+}
+
+// ---------------------------------------------------------------------------
+bool QuasiEquilibrium::Pair::involves( uint index ) const {
+	if( index == bound )
+		return true;
+	for( uint i = 0; i < sides; i++ ) {
+		if( index == species[i] )
+			return true;
+	}
+	return false;
+}
+
+// ---------------------------------------------------------------------------
+QuasiEquilibrium::QuasiEquilibrium( Compartment *in, const Pair *pair ) throw()
+: ReactionInstance( in )
+, compartment(in)
+, pair(pair)
+, updSelf(false)
+{
+	for( uint i = 0; i < pair->sides; i++ )
+		compartment->addDependency( pair->species[i], this );
+	compartment->addDependency( pair->bound, this );
+}
+
+// ---------------------------------------------------------------------------
+QuasiEquilibrium::~QuasiEquilibrium() throw() {
+	for( uint i = 0; i < pair->sides; i++ )
+		compartment->removeDependency( pair->species[i], this );
+	compartment->removeDependency( pair->bound, this );
+}
+
+// ---------------------------------------------------------------------------
+// Is the reaction a plain mass-action one in a single compartment?
+static bool isPlain( const reaction::Template *tmplate ) {
+	return !tmplate->isUmbrellaReaction() && !tmplate->isFireOnceReaction() && !tmplate->hasExtras() &&
+		tmplate->hasDefaultHEvaluator() && tmplate->getCompartmentCount() <= 1;
+}
+
+// ---------------------------------------------------------------------------
+bool QuasiEquilibrium::describePair( const reaction::Template *forward, const reaction::Template *reverse, Pair &pair ) {
+	if( !isPlain( forward ) || !isPlain( reverse ) )
+		return false;
+
+	// S is X, A + B or 2 A, read with its stoichiometry
+	pair.sides = 0;
+	for( Reactant *r = forward->getFirstReactant(); r; r = r->getNext() ) {
+		int n = r->getConsumes();
+		if( pair.sides == 2 || n < 1 || n > 2 || BasicRateFunction::getGilHOrder( r->getRateFunction() ) != n )
+			return false;
+		pair.species[pair.sides] = r->getIndex();
+		pair.stoich[pair.sides++] = n;
+	}
+	if( pair.sides == 0 || (pair.sides == 2 &&
+		(pair.stoich[0] != 1 || pair.stoich[1] != 1 || pair.species[0] == pair.species[1])) )
+		return false;
+
+	Product *prod = forward->getFirstProduct();
+	if( !prod || prod->getNext() || prod->getProduces() != 1 || !prod->getTau()->isZero() )
+		return false;
+	pair.bound = prod->getIndex();
+	for( uint i = 0; i < pair.sides; i++ ) {
+		if( pair.species[i] == pair.bound )
+			return false;
+	}
+
+	// C -> S, with the products adding up to S
+	Reactant *r = reverse->getFirstReactant();
+	if( !r || r->getNext() || r->getIndex() != pair.bound || r->getConsumes() != 1 ||
+		BasicRateFunction::getGilHOrder( r->getRateFunction() ) != 1 )
+		return false;
+	int produced[2] = { 0, 0 };
+	for( prod = reverse->getFirstProduct(); prod; prod = prod->getNext() ) {
+		uint i = 0;
+		while( i < pair.sides && pair.species[i] != prod->getIndex() )
+			i++;
+		if( i == pair.sides || !prod->getTau()->isZero() )
+			return false;
+		produced[i] += prod->getProduces();
+	}
+	for( uint i = 0; i < pair.sides; i++ ) {
+		if( produced[i] != (int)pair.stoich[i] )
+			return false;
+	}
+
+	pair.totals[0] = pair.totals[1] = (uint)-1;
+	pair.k = forward->getC() / reverse->getC();
+	pair.p = forward->getC() / (forward->getC() + reverse->getC());
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+bool QuasiEquilibrium::canRewrite( const reaction::Template *tmplate, const Pair &pair ) {
+	// Special H-functions read their reactants in their own ways. A reactant
+	// consuming more than it reads could take the totals below zero.
+	bool reads = false;
+	for( Reactant *r = tmplate->getFirstReactant(); r; r = r->getNext() ) {
+		if( !pair.involves( r->getIndex() ) )
+			continue;
+		int order = BasicRateFunction::getGilHOrder( r->getRateFunction() );
+		if( order < 0 || order < r->getConsumes() )
+			return false;
+		reads = true;
+	}
+	return !reads || tmplate->hasDefaultHEvaluator();
+}
+
+// ---------------------------------------------------------------------------
+void QuasiEquilibrium::rewrite( reaction::Template *tmplate, const Pair *pair ) {
+	// orders[i] for the species of S, orders[2] for C
+	uint orders[3] = { 0, 0, 0 };
+	for( Reactant *r = tmplate->getFirstReactant(); r; r = r->getNext() ) {
+		if( !pair->involves( r->getIndex() ) )
+			continue;
+		int order = BasicRateFunction::getGilHOrder( r->getRateFunction() );
+		assert( order >= 0 );
+		orders[r->getIndex() == pair->bound ? 2 : (r->getIndex() == pair->species[0] ? 0 : 1)] += order;
+		*r->getRateFunction() = RateFunction::Unit();
+	}
+	uint a = orders[0], b = orders[2];
+	if( a + orders[1] + b == 0 )
+		return;
+
+	if( pair->isIsomerization() ) {
+		// Given the total n, X and C are binomial, so the average of
+		// C(X,a) C(C,b) is C(a+b,a) (1-p)^a p^b C(n,a+b)
+		double factor = pow( 1.0 - pair->p, (int)a ) * pow( pair->p, (int)b );
+		for( uint k = 1; k <= b; k++ )
+			factor *= (double)(a + k) / k;
+		tmplate->setC( tmplate->getC() * factor );
+		*tmplate->newReactant( pair->totals[0], 0, 0 )->getRateFunction() = BasicRateFunction::GilH( a + b );
+		return;
+	}
+
+	// No closed form, so the average is summed when evaluated. The reaction
+	// reads every total so that it is updated when they change.
+	assert( orders[0] < 256 && orders[1] < 256 );
+	RateFunction marker;
+	marker.fn = &averagedRateFunction;
+	marker.p1.p = (void *)pair;
+	marker.p2.ui = orders[0] | (orders[1] << 8) | (orders[2] << 16);
+	if( pair->sides == 2 )
+		*tmplate->newReactant( pair->totals[1], 0, 0 )->getRateFunction() = RateFunction::Unit();
+	*tmplate->newReactant( pair->totals[0], 0, 0 )->getRateFunction() = marker;
+	tmplate->setHEvaluator( &hEval_averaged );
+}
+
+// ---------------------------------------------------------------------------
+double QuasiEquilibrium::getRatio( const Pair *pair, const Population *totals, Population k ) {
+	// Detailed balance: w(k+1) c_r (k+1) = w(k) c_f h_S(k)
+	double ratio = pair->k / (double)(k + 1);
+	for( uint i = 0; i < pair->sides; i++ )
+		ratio *= choose( totals[i] - (Population)pair->stoich[i] * k, pair->stoich[i] );
+	return ratio;
+}
+
+// ---------------------------------------------------------------------------
+void QuasiEquilibrium::findRange( const Pair *pair, const Population *totals, Population &lo, Population &hi, double &weightLo, double &sum ) {
+	Population kMax = totals[0] / (Population)pair->stoich[0];
+	if( pair->sides == 2 )
+		kMax = std::min( kMax, totals[1] / (Population)pair->stoich[1] );
+	weightLo = sum = 1.0;
+	if( kMax <= 0 ) {
+		lo = hi = 0;
+		return;
+	}
+
+	// The ratios fall as k grows, so the mode is the first k at which
+	// they drop below one
+	Population mode = 0, end = kMax;
+	while( mode < end ) {
+		Population mid = mode + (end - mode) / 2;
+		if( getRatio( pair, totals, mid ) >= 1.0 ) {
+			mode = mid + 1;
+		} else {
+			end = mid;
+		}
+	}
+
+	double w = 1.0;
+	for( hi = mode; hi < kMax; hi++ ) {
+		w *= getRatio( pair, totals, hi );
+		if( w < NEGLIGIBLE_WEIGHT * sum )
+			break;
+		sum += w;
+	}
+	w = 1.0;
+	for( lo = mode; lo > 0; lo-- ) {
+		w /= getRatio( pair, totals, lo - 1 );
+		if( w < NEGLIGIBLE_WEIGHT * sum )
+			break;
+		sum += w;
+		weightLo = w;
+	}
+}
+
+// ---------------------------------------------------------------------------
+double QuasiEquilibrium::average( const Pair *pair, const Population *totals, const uint *orders ) {
+	Population lo, hi;
+	double w, sum;
+	findRange( pair, totals, lo, hi, w, sum );
+
+	double avg = 0.0;
+	for( Population k = lo; ; k++ ) {
+		double f = choose( k, orders[2] );
+		for( uint i = 0; i < pair->sides; i++ )
+			f *= choose( totals[i] - (Population)pair->stoich[i] * k, orders[i] );
+		avg += w * f;
+		if( k == hi )
+			break;
+		w *= getRatio( pair, totals, k );
+	}
+	return avg / sum;
+}
+
+// ---------------------------------------------------------------------------
+double SGNS_FASTCALL QuasiEquilibrium::averagedRateFunction( RateFunction *, Population ) {
+	return 1.0;
+}
+
+// ---------------------------------------------------------------------------
+double SGNS_FASTCALL QuasiEquilibrium::hEval_averaged( Compartment **context, Reactant *r ) {
+	double h = 1.0;
+	Reactant *marker = NULL;
+	for( ; r; r = r->getNext() ) {
+		if( r->getRateFunction()->fn == &averagedRateFunction ) {
+			marker = r;
+		} else {
+			h *= r->evaluate( context );
+		}
+	}
+	assert( marker );
+
+	const RateFunction *f = marker->getRateFunction();
+	const Pair *pair = (const Pair *)f->p1.p;
+	uint orders[3] = { f->p2.ui & 0xff, (f->p2.ui >> 8) & 0xff, f->p2.ui >> 16 };
+	Compartment *in = context[marker->getCompartmentIndex()];
+	Population totals[2];
+	for( uint i = 0; i < pair->sides; i++ )
+		totals[i] = in->getPopulation( pair->totals[i] );
+	return h * average( pair, totals, orders );
+}
+
+// ---------------------------------------------------------------------------
+void QuasiEquilibrium::begin() throw() {
+	// A compartment moved into a new container keeps its populations
+	updSelf = false;
+	for( uint i = 0; i < pair->sides; i++ ) {
+		if( compartment->getPopulation( pair->species[i] ) + (Population)pair->stoich[i] * compartment->getPopulation( pair->bound ) !=
+			compartment->getPopulation( pair->totals[i] ) )
+			popUpdate( pair->bound );
+	}
+}
+
+// ---------------------------------------------------------------------------
+void QuasiEquilibrium::trigger() throw() {
+	assert( false );
+}
+
+// ---------------------------------------------------------------------------
+void QuasiEquilibrium::popUpdate( uint ) throw() {
+	if( !updSelf ) {
+		restoreNonNegative();
+		updSelf = true;
+		scheduleForUpdate();
+	}
+}
+
+// ---------------------------------------------------------------------------
+void QuasiEquilibrium::restoreNonNegative() throw() {
+	// The rewritten reactions fire on the average over the equilibrium, so
+	// one may consume a species which the last draw left empty. Moving
+	// molecules between S and C keeps the totals, which is all that the
+	// next draw and the rewritten propensities read, so nobody else needs
+	// to be told.
+	Population c = compartment->getPopulation( pair->bound );
+	for( ;; ) {
+		bool below = false, spare = true;
+		for( uint i = 0; i < pair->sides; i++ ) {
+			Population x = compartment->getPopulation( pair->species[i] );
+			below = below || x < 0;
+			spare = spare && x >= (Population)pair->stoich[i];
+		}
+		int step = below && c > 0 ? 1 : (c < 0 && spare ? -1 : 0);
+		if( step == 0 )
+			break;
+		c -= step;
+		for( uint i = 0; i < pair->sides; i++ )
+			compartment->modifyPopulationNoUpdate( pair->species[i], step * (Population)pair->stoich[i] );
+	}
+	if( c != compartment->getPopulation( pair->bound ) )
+		compartment->setPopulationNoUpdate( pair->bound, c );
+}
+
+// ---------------------------------------------------------------------------
+void QuasiEquilibrium::update() throw() {
+	// The fast pair relaxes instantly, so the new totals are all that matter
+	Population c = compartment->getPopulation( pair->bound );
+	Population totals[2];
+	for( uint i = 0; i < pair->sides; i++ )
+		totals[i] = compartment->getPopulation( pair->species[i] ) + (Population)pair->stoich[i] * c;
+
+	Population y;
+	if( pair->isIsomerization() ) {
+		y = totals[0] > 0 ? (Population)compartment->getSimulation()->getRNG()->binomial( pair->p, (int)totals[0] ) : 0;
+	} else {
+		Population hi;
+		double w, sum;
+		findRange( pair, totals, y, hi, w, sum );
+		double u = compartment->getSimulation()->getRNG()->rand_halfclosed01() * sum;
+		while( y < hi && (u -= w) >= 0.0 ) {
+			w *= getRatio( pair, totals, y );
+			y++;
+		}
+	}
+
+	// updSelf stays set so that these changes are not picked up again
+	if( c != y ) {
+		for( uint i = 0; i < pair->sides; i++ )
+			compartment->setPopulation( pair->species[i], totals[i] - (Population)pair->stoich[i] * y );
+		compartment->setPopulation( pair->bound, y );
+	}
+	for( uint i = 0; i < pair->sides; i++ ) {
+		if( compartment->getPopulation( pair->totals[i] ) != totals[i] )
+			compartment->setPopulation( pair->totals[i], totals[i] );
+	}
+	updSelf = false;
+}
+
+} // namespace sgns2
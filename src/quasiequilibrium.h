@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2011, Jason Lloyd-Price, Abhishekh Gupta, and Andre S. Ribeiro
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of the contributors may not be used to endorse or promote
+	  products derived from this software without specific prior written
+	  permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/* quasiequilibrium.h/cpp
+
+QuasiEquilibrium class contents:
+	- ReactionInstance which stands in for a fast reversible pair of
+	  reactions S -> C and C -> S in a compartment, where S is X
+	  (isomerization), A + B (binding) or 2 A (dimerization), in the manner
+	  of the slow-scale SSA of Cao, Gillespie and Petzold (2005)
+	- Never enters the event queue. Whenever something else changes the
+	  species of the pair, redraws C from its equilibrium distribution given
+	  the conserved totals of the species of S, each counting what is bound
+	  in C, and keeps those totals in hidden species. For isomerizations the
+	  distribution is binomial; otherwise it is summed numerically.
+	- Rewrites the propensities of the other reactions reading the species
+	  into their averages over that distribution, which read the totals
+	  instead
+*/
+
+#ifndef QUASIEQUILIBRIUM_H
+#define QUASIEQUILIBRIUM_H
+
+#include "reactioninstance.h"
+#include "reaction.h"
+
+namespace sgns2 {
+
+// ===========================================================================
+class QuasiEquilibrium : public ReactionInstance {
+public:
+	// A fast reversible pair S -> C, C -> S
+	struct Pair {
+		uint sides; // Number of species in S, 1 or 2
+		uint species[2]; // The species in S
+		uint stoich[2]; // Their stoichiometries in S
+		uint bound; // The species C
+		uint totals[2]; // Hidden species holding species[i] + stoich[i] C
+		double k; // Ratio of the forward and reverse stochastic constants
+		double p; // For isomerizations, the fraction of the total in C
+
+		inline bool isIsomerization() const { return sides == 1 && stoich[0] == 1; }
+		// Is the species one of the pair's?
+		bool involves( uint index ) const;
+	};
+
+	QuasiEquilibrium( Compartment *in, const Pair *pair ) throw();
+	virtual ~QuasiEquilibrium() throw();
+
+	// Are the reactions S -> C and C -> S, with mass-action propensities and
+	// nothing else? If so, fills in all of pair but the totals.
+	static bool describePair( const reaction::Template *forward, const reaction::Template *reverse, Pair &pair );
+	// Can the propensity of the reaction be averaged over the equilibrium of
+	// the pair? Only mass-action propensities can.
+	static bool canRewrite( const reaction::Template *tmplate, const Pair &pair );
+	// Rewrites the propensity of the reaction into its average over the
+	// equilibrium of the pair. The reaction keeps consuming the species.
+	static void rewrite( reaction::Template *tmplate, const Pair *pair );
+
+	// Brings the totals up to date if needed
+	virtual void begin() throw();
+	// Never called, since the instance is never queued
+	virtual void trigger() throw();
+	// Schedules a new draw when the species are changed by others
+	virtual void popUpdate( uint cookie ) throw();
+	// Draws the species from the equilibrium given their new totals
+	virtual void update() throw();
+
+private:
+	Compartment *compartment;
+	const Pair *pair;
+	bool updSelf; // Set while a draw is scheduled or being written
+
+	// Undoes, without notifying anyone, firings of slow reactions which
+	// consumed species averaged over the equilibrium but not present
+	void restoreNonNegative() throw();
+
+	// Weight of k + 1 bound relative to k bound, given the totals
+	static double getRatio( const Pair *pair, const Population *totals, Population k );
+	// Finds the range of the number bound outside which the distribution
+	// given the totals is negligible, the weight of its lowest value
+	// relative to the mode and the sum of the weights in it
+	static void findRange( const Pair *pair, const Population *totals, Population &lo, Population &hi, double &weightLo, double &sum );
+	// Average of the product of C(X_i, orders[i]) over the species of S and
+	// C(C, orders[2]) over the distribution given the totals
+	static double average( const Pair *pair, const Population *totals, const uint *orders );
+
+	// Marks the reactant on the first total of a rewritten reaction, whose
+	// parameters hold the pair and the orders it reads the species to
+	static double SGNS_FASTCALL averagedRateFunction( RateFunction *me, Population X );
+	// H-function of the rewritten reactions of non-isomerization pairs
+	static double SGNS_FASTCALL hEval_averaged( Compartment **context, reaction::Reactant *firstReactant );
+};
+
+} // namespace sgns2
+
+#endif // QUASIEQUILIBRIUM_H
@@ -8,6 +8,7 @@
 #include <float.h>
 #include <algorithm>
 #include <cassert>
+#include <sstream>
 
 #include "rate.h"
 
@@ -62,6 +63,18 @@ RateFunction BasicRateFunction::GilH( int N ) {
 	return f;
 }
 
+int BasicRateFunction::getGilHOrder( const RateFunction *f ) {
+	if( f->fn == &unitRateFunction )
+		return 0;
+	if( f->fn == &linearRateFunction )
+		return 1;
+	if( f->fn == &gilh2RateFunction )
+		return 2;
+	if( f->fn == &gilhRateFunction )
+		return f->p1.i;
+	return -1;
+}
+
 double SGNS_FASTCALL BasicRateFunction::gilhRateFunction( RateFunction *me, Population X ) {
 	// General
 	BasicRateFunction *me2 = (BasicRateFunction*)me;
@@ -240,4 +253,162 @@ double SGNS_FASTCALL BasicRateFunction::step2RateFunction( RateFunction *me, Pop
 	return X < me2->p1.pop ? 1.0 : me2->p2.d;
 }
 
+// ---------------------------------------------------------------------------
+// Writes a double so that it reads back as the same value and type
+static bool writeDouble( std::ostream &out, double d ) {
+	if( !(d - d == 0.0) )
+		return false; // Infinities and NaNs have no literal
+	std::ostringstream ss;
+	ss.precision( 17 );
+	ss << d;
+	std::string s = ss.str();
+	if( s.find_first_of( ".e" ) == std::string::npos )
+		s.append( ".0" );
+	out << "(" << s << ")";
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+bool BasicRateFunction::writeProduct( const RateFunction *f, const char *X, std::string &code ) {
+	// Native code calculates tabled functions rather than reading the table
+	if( f->fn == &tabledRateFunction )
+		f = getTable( f )->getFunction();
+
+	std::ostringstream out;
+	out << "{ const Population X = " << X << "; const double x = (double)X; ";
+	bool ok = true;
+	if( f->fn == &unitRateFunction ) {
+		return true;
+	} else if( f->fn == &linearRateFunction ) {
+		out << "h *= x;";
+	} else if( f->fn == &gilh2RateFunction ) {
+		out << "h *= std::fabs( x * (double)(X-1) / 2.0 );";
+	} else if( f->fn == &gilhRateFunction ) {
+		out << "double v = x; ";
+		for( int i = 1; i < f->p1.i; i++ )
+			out << "v *= (x - " << i << ".0) / " << i + 1 << ".0; ";
+		out << "h *= v;";
+	} else if( f->fn == &squareRateFunction ) {
+		out << "h *= x*x;";
+	} else if( f->fn == &cubeRateFunction ) {
+		out << "h *= x*x*x;";
+	} else if( f->fn == &powRateFunction ) {
+		out << "h *= std::pow( x, ";
+		ok = writeDouble( out, f->p1.d );
+		out << " );";
+	} else if( f->fn == &hill1RateFunction ) {
+		out << "h *= x / (x + ";
+		ok = writeDouble( out, f->p1.d );
+		out << ");";
+	} else if( f->fn == &hill2RateFunction ) {
+		out << "h *= x*x / (x*x + ";
+		ok = writeDouble( out, f->p1.d );
+		out << ");";
+	} else if( f->fn == &hillnRateFunction ) {
+		out << "const double xn = std::pow( x, ";
+		ok = writeDouble( out, f->p2.d );
+		out << " ); h *= xn / (xn + ";
+		ok = ok && writeDouble( out, f->p1.d );
+		out << ");";
+	} else if( f->fn == &invhill1RateFunction || f->fn == &invhill2RateFunction ) {
+		out << "h *= ";
+		ok = writeDouble( out, f->p1.d );
+		out << (f->fn == &invhill1RateFunction ? " / (x + " : " / (x*x + ");
+		ok = ok && writeDouble( out, f->p1.d );
+		out << ");";
+	} else if( f->fn == &invhillnRateFunction ) {
+		out << "const double xn = std::pow( x, ";
+		ok = writeDouble( out, f->p2.d );
+		out << " ); h *= ";
+		ok = ok && writeDouble( out, f->p1.d );
+		out << " / (xn + ";
+		ok = ok && writeDouble( out, f->p1.d );
+		out << ");";
+	} else if( f->fn == &minRateFunction || f->fn == &maxRateFunction ) {
+		out << (f->fn == &minRateFunction ? "h *= std::min( " : "h *= std::max( ");
+		ok = writeDouble( out, f->p1.d );
+		out << ", x );";
+	} else if( f->fn == &stepRateFunction || f->fn == &step2RateFunction ) {
+		out << "h *= X < (Population)" << f->p1.pop << " ? ";
+		if( f->fn == &stepRateFunction ) {
+			ok = writeDouble( out, f->p2.d );
+			out << " : 1.0;";
+		} else {
+			out << "1.0 : ";
+			ok = writeDouble( out, f->p2.d );
+			out << ";";
+		}
+	} else {
+		// Not one of ours
+		return false;
+	}
+	if( !ok )
+		return false;
+	out << " }";
+	code.append( out.str() );
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// f(x) = table[x], or the table's function past its end
+RateFunction BasicRateFunction::Tabled( const RateTable *table ) {
+	BasicRateFunction f;
+	f.fn = &tabledRateFunction;
+	f.p1.p = const_cast<RateTable*>(table);
+	return f;
+}
+
+bool BasicRateFunction::isTabulable( const RateFunction *f ) {
+	return f->fn == &powRateFunction || f->fn == &hillnRateFunction || f->fn == &invhillnRateFunction;
+}
+
+bool BasicRateFunction::isSameTabulable( const RateFunction *f, const RateFunction *g ) {
+	if( f->fn != g->fn || !isTabulable( f ) )
+		return false;
+	// pow only has its exponent
+	return f->p1.d == g->p1.d && (f->fn == &powRateFunction || f->p2.d == g->p2.d);
+}
+
+const RateTable *BasicRateFunction::getTable( const RateFunction *f ) {
+	return f->fn == &tabledRateFunction ? static_cast<const RateTable*>(f->p1.p) : NULL;
+}
+
+double SGNS_FASTCALL BasicRateFunction::tabledRateFunction( RateFunction *me, Population X ) {
+	return static_cast<const RateTable*>(me->p1.p)->evaluate( X );
+}
+
+// ---------------------------------------------------------------------------
+SGNS_THREADLOCAL uint64 RateTable::hits = 0;
+SGNS_THREADLOCAL uint64 RateTable::misses = 0;
+bool RateTable::counting = false;
+
+// ---------------------------------------------------------------------------
+RateTable::RateTable( const RateFunction &f, uint size )
+: fn(f)
+, size(size)
+, values(size)
+{
+	// The same calculation as the function, so lookups change nothing
+	for( uint i = 0; i < size; i++ )
+		values[i] = fn.evaluate( (Population)i );
+}
+
+// ---------------------------------------------------------------------------
+RateTable::~RateTable() {
+}
+
+// ---------------------------------------------------------------------------
+uint64 RateTable::takeHitCount() {
+	uint64 n = hits;
+	hits = 0;
+	return n;
+}
+
+// ---------------------------------------------------------------------------
+uint64 RateTable::takeMissCount() {
+	uint64 n = misses;
+	misses = 0;
+	return n;
+}
+
 } // namespace
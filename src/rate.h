@@ -34,15 +34,26 @@ RateFunction class contents:
 
 BasicRateFunction class contents:
 	- Some more functions useful in SGNS
+	- Writes C++ code equivalent to the functions for native compilation
+	- Table lookup in place of the functions which call pow()
+
+RateTable class contents:
+	- Values of a rate function at small populations
+	- Counts of the evaluations served from tables
 */
 
 #ifndef _RATE_H
 #define _RATE_H
 
+#include <string>
+#include <vector>
+
 #include "simtypes.h"
 
 namespace sgns2 {
 
+class RateTable;
+
 class RateFunction
 {
 public:
@@ -93,6 +104,8 @@ class BasicRateFunction : public RateFunction {
 public:
 	// f(x) = X!/N!(X-N)!
 	static RateFunction GilH( int N );
+	// Get N if f is a GilH( N ) function (including Unit and Linear), or -1
+	static int getGilHOrder( const RateFunction *f );
 
 	// f(x) = x^n
 	static RateFunction Pow( double n );
@@ -114,6 +127,21 @@ public:
 	// f(x) = 1 if x < thresh, else v
 	static RateFunction Step2( Population thresh, double v );
 
+	// Appends a C++ statement which multiplies the double h by f(X), where
+	// X is an expression of type Population, doing the exact same floating
+	// point operations as f. Returns false if f has no C++ equivalent.
+	static bool writeProduct( const RateFunction *f, const char *X, std::string &code );
+
+	// f(x) looked up in the table, or calculated by the table's function
+	// for populations past its end
+	static RateFunction Tabled( const RateTable *table );
+	// Does f call pow(), so that looking it up in a table pays off?
+	static bool isTabulable( const RateFunction *f );
+	// Are f and g the same tabulable function with the same parameters?
+	static bool isSameTabulable( const RateFunction *f, const RateFunction *g );
+	// The table f looks its values up in, or NULL if f is not Tabled
+	static const RateTable *getTable( const RateFunction *f );
+
 protected:
 	static double SGNS_FASTCALL gilhRateFunction( RateFunction *me, Population X );
 	static double SGNS_FASTCALL gilh2RateFunction( RateFunction *me, Population X );
@@ -134,6 +162,52 @@ protected:
 	static double SGNS_FASTCALL maxRateFunction( RateFunction *me, Population X );
 	static double SGNS_FASTCALL stepRateFunction( RateFunction *me, Population X );
 	static double SGNS_FASTCALL step2RateFunction( RateFunction *me, Population X );
+
+	static double SGNS_FASTCALL tabledRateFunction( RateFunction *me, Population X );
+};
+
+class RateTable {
+public:
+	// Tabulates f over the populations 0..size-1
+	RateTable( const RateFunction &f, uint size );
+	~RateTable();
+
+	inline double evaluate( Population X ) const {
+		if( (uint64)X < size ) {
+			if( counting )
+				hits++;
+			return values[(size_t)X];
+		}
+		if( counting )
+			misses++;
+		return fn.evaluate( X );
+	}
+
+	// The tabulated function
+	inline const RateFunction *getFunction() const { return &fn; }
+	inline uint getSize() const { return size; }
+
+	// For other tables of rate-like functions
+	static inline void countHit() { if( counting ) hits++; }
+	static inline void countMiss() { if( counting ) misses++; }
+	// The number of evaluations served from tables, and of those which fell
+	// back to their functions, by the calling thread since the last call
+	static uint64 takeHitCount();
+	static uint64 takeMissCount();
+	// Manage whether evaluations are counted (off by default, as the counts
+	// are only shown with the performance output)
+	static inline void setCounting( bool on ) { counting = on; }
+	static inline bool isCounting() { return counting; }
+
+private:
+	mutable RateFunction fn;
+	uint size;
+	std::vector<double> values;
+
+	// Per-thread, so that batch threads do not contend for them
+	static SGNS_THREADLOCAL uint64 hits;
+	static SGNS_THREADLOCAL uint64 misses;
+	static bool counting;
 };
 
 } // namespace
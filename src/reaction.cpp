@@ -5,9 +5,11 @@
 
 #include <cassert>
 #include <algorithm>
+#include <new>
 
 #include "compartment.h"
 #include "reaction.h"
+#include "reactiongroup.h"
 
 namespace sgns2 {
 namespace reaction {
@@ -29,6 +31,7 @@ Reactant::~Reactant() {
 // ---------------------------------------------------------------------------
 Product::Product( int amount, uint speciesIndex, uint compartmentIndex, Product *next )
 : tau(RuntimeDistribution::DeltaDistribution(0.0))
+, delaySlot((uint)-1)
 , produces(amount)
 , destCompartment(compartmentIndex)
 , destIndex(speciesIndex)
@@ -46,8 +49,10 @@ void Product::release( Compartment **context ) throw() {
 		// Delayed release
 		Compartment *dest = context[destCompartment];
 		SimulationInstance *sim = dest->getSimulation();
-		double dt = tau.sample( sim->distrCtx() );
-		dest->getWaitList()->releaseAt( sim->getTime() + dt, destIndex, produces );
+		if( tau.isConstant() )
+			dest->getWaitList()->releaseAfter( sim->getTime(), tau.sample( sim->distrCtx() ), destIndex, produces );
+		else
+			dest->getWaitList()->releaseAt( sim->getTime() + sampleTau( sim->distrCtx() ), destIndex, produces );
 	} else {
 		// Delay-less release
 		context[destCompartment]->modifyPopulation( destIndex, produces );
@@ -62,9 +67,20 @@ Template::Template( bool umbrella, bool fireOnce ) throw()
 , firstExtra(NULL)
 , isUmbrella(umbrella)
 , firesOnce(fireOnce)
+, engine(ENGINE_NRM)
 , nCompartments(0)
 , hEval(&default_hEval)
-{ }
+, flat(NULL)
+, flatH(false)
+, nativeH(false)
+, factorBegin(0)
+, factorEnd(0)
+, changeBegin(0)
+, changeEnd(0)
+, shape(SHAPE_GENERAL)
+{
+	shapeSpecies[0] = shapeSpecies[1] = 0;
+}
 
 // ---------------------------------------------------------------------------
 Template::~Template() throw() {
@@ -72,6 +88,10 @@ Template::~Template() throw() {
 
 // ---------------------------------------------------------------------------
 void Template::execute( Compartment **context ) const throw() {
+	if( flat ) {
+		flat->execute( context, changeBegin, changeEnd );
+		return;
+	}
 	for( Reactant *s = firstReactant; s; s = s->getNext() )
 		s->consume( context );
 	for( Product *p = firstProduct; p; p = p->getNext() )
@@ -90,51 +110,117 @@ void Template::executeExtra( Compartment **context ) const throw() {
 }
 
 // ---------------------------------------------------------------------------
-ReactionInstance *Template::instantiate( Compartment **in, ReactionInstance *umbrellaInst ) const throw() {
-	ReactionInstance *inst = NULL;
-	EventQueue *q = in[0];
-	if( umbrellaInst )
-		q = static_cast<UmbrellaInstance*>(umbrellaInst);
+// Constructs an instance in the given memory, or on the heap if it is NULL
+template< typename Inst, typename Stoich >
+static inline Inst *construct( void *mem, EventQueue *q, const Stoich &stoich ) {
+	if( mem )
+		return new (mem) Inst( q, stoich );
+	return new Inst( q, stoich );
+}
+
+// ---------------------------------------------------------------------------
+Template::InstanceClass Template::getInstanceClass() const throw() {
+	if( engine != ENGINE_NRM )
+		return CLASS_MEMBER;
 	if( isUmbrella ) {
-		if( nCompartments <= 1 ) {
-			// NOTE: Umbrella reactions are naturally compatible with firesOnce
-			TemplateStoich<1> stoich( this, in );
-			inst = new UmbrellaInstance( q, stoich );
-		} else {
-			assert( false ); // >= 2 Compartment Umbrella reactions NYI
-		}
-	} else if( firesOnce ) {
-		switch( nCompartments ) {
-		case 0: // Fallthrough
-		case 1: {
-				TemplateStoich<1> stoich( this, in );
-				inst = new FireOnceInstance( q, stoich );
-			} break;
-		default:
-			assert( false ); // >= 2 Compartment reactions NYI
+		assert( nCompartments <= 1 ); // >= 2 Compartment Umbrella reactions NYI
+		return CLASS_UMBRELLA;
+	}
+	if( firesOnce ) {
+		assert( nCompartments <= 1 ); // >= 2 Compartment reactions NYI
+		return CLASS_FIRE_ONCE;
+	}
+	switch( nCompartments ) {
+	case 0: // Fallthrough
+	case 1:
+		switch( shape ) {
+		case SHAPE_ZEROTH: return CLASS_ZEROTH_ORDER;
+		case SHAPE_FIRST: return CLASS_FIRST_ORDER;
+		case SHAPE_SECOND: return CLASS_SECOND_ORDER;
+		case SHAPE_DIMER: return CLASS_DIMER;
+		default: return CLASS_GENERAL;
 		}
-	} else {
-		switch( nCompartments ) {
-		case 0: // Fallthrough
-		case 1: {
-				TemplateStoich<1> stoich( this, in );
-				inst = new Instance( q, stoich );
-			} break;
-		case 2: {
-				TemplateStoich<2> stoich( this, in );
-				inst = new InterfaceInstance( q, stoich );
-			} break;
-		case 3: {
-				TemplateStoich<3> stoich( this, in );
-				inst = new ThreeWayInstance( q, stoich );
-			} break;
-		default:
-			assert( false ); // >= 4 Compartment reactions NYI
+	case 2:
+		return CLASS_INTERFACE;
+	default:
+		assert( nCompartments == 3 ); // >= 4 Compartment reactions NYI
+		return CLASS_THREE_WAY;
+	}
+}
+
+// ---------------------------------------------------------------------------
+size_t Template::getInstanceSize() const throw() {
+	switch( getInstanceClass() ) {
+	case CLASS_UMBRELLA: return sizeof(UmbrellaInstance);
+	case CLASS_FIRE_ONCE: return sizeof(FireOnceInstance);
+	case CLASS_ZEROTH_ORDER: return sizeof(ZerothOrderInstance);
+	case CLASS_FIRST_ORDER: return sizeof(FirstOrderInstance);
+	case CLASS_SECOND_ORDER: return sizeof(SecondOrderInstance);
+	case CLASS_DIMER: return sizeof(DimerInstance);
+	case CLASS_GENERAL: return sizeof(Instance);
+	case CLASS_INTERFACE: return sizeof(InterfaceInstance);
+	case CLASS_THREE_WAY: return sizeof(ThreeWayInstance);
+	default: return 0; // Allocated by the group
+	}
+}
+
+// ---------------------------------------------------------------------------
+ReactionInstance *Template::instantiate( Compartment **in, ReactionInstance *umbrellaInst, void *mem ) const throw() {
+	InstanceClass cls = getInstanceClass();
+	if( cls == CLASS_MEMBER ) {
+		// Handed over to the compartment's reaction group, which takes care
+		// of the dependencies itself
+		assert( !umbrellaInst && !mem );
+		ReactionGroup *group = in[0]->getReactionGroup();
+		if( !group ) {
+			group = ReactionGroup::create( getEngine(), in[0] );
+			in[0]->setReactionGroup( group );
 		}
+		assert( group->getEngine() == getEngine() );
+		return group->newMember( this );
+	}
+
+	EventQueue *q = in[0];
+	if( umbrellaInst )
+		q = static_cast<UmbrellaInstance*>(umbrellaInst);
+	ReactionInstance *inst = NULL;
+	switch( cls ) {
+	case CLASS_UMBRELLA:
+		// NOTE: Umbrella reactions are naturally compatible with firesOnce
+		inst = construct<UmbrellaInstance>( mem, q, TemplateStoich<1>( this, in ) );
+		break;
+	case CLASS_FIRE_ONCE:
+		inst = construct<FireOnceInstance>( mem, q, TemplateStoich<1>( this, in ) );
+		break;
+	case CLASS_ZEROTH_ORDER:
+		inst = construct<ZerothOrderInstance>( mem, q, MassActionStoich<SHAPE_ZEROTH>( this, in ) );
+		inst->setKind( EventStream::KIND_ZEROTH_ORDER );
+		break;
+	case CLASS_FIRST_ORDER:
+		inst = construct<FirstOrderInstance>( mem, q, MassActionStoich<SHAPE_FIRST>( this, in ) );
+		inst->setKind( EventStream::KIND_FIRST_ORDER );
+		break;
+	case CLASS_SECOND_ORDER:
+		inst = construct<SecondOrderInstance>( mem, q, MassActionStoich<SHAPE_SECOND>( this, in ) );
+		inst->setKind( EventStream::KIND_SECOND_ORDER );
+		break;
+	case CLASS_DIMER:
+		inst = construct<DimerInstance>( mem, q, MassActionStoich<SHAPE_DIMER>( this, in ) );
+		inst->setKind( EventStream::KIND_DIMER );
+		break;
+	case CLASS_GENERAL:
+		inst = construct<Instance>( mem, q, TemplateStoich<1>( this, in ) );
+		inst->setKind( EventStream::KIND_REACTION );
+		break;
+	case CLASS_INTERFACE:
+		inst = construct<InterfaceInstance>( mem, q, TemplateStoich<2>( this, in ) );
+		break;
+	default:
+		inst = construct<ThreeWayInstance>( mem, q, TemplateStoich<3>( this, in ) );
+		break;
 	}
 
 	addDependencies( in, inst );
-	inst->begin();
 
 	return inst;
 }
@@ -189,6 +275,90 @@ void Template::addExtra( Template::Extra *extra ) {
 	firstExtra = extra;
 }
 
+// ---------------------------------------------------------------------------
+void Template::compile( FlatTable *table ) {
+	flat = table;
+
+	// Custom and native H-functions keep reading the reactant list
+	flatH = hEval == &default_hEval;
+	factorBegin = factorEnd = (uint)table->factorSpecies.size();
+	if( flatH ) {
+		for( Reactant *r = firstReactant; r; r = r->getNext() ) {
+			RateFunction *f = r->getRateFunction();
+			FlatTable::RateKind kind;
+			switch( BasicRateFunction::getGilHOrder( f ) ) {
+			case 0: continue; // Multiplying by one changes nothing
+			case 1: kind = FlatTable::RATE_LINEAR; break;
+			case 2: kind = FlatTable::RATE_GILH2; break;
+			default: kind = FlatTable::RATE_OTHER; break;
+			}
+			table->factorCompartment.push_back( r->getCompartmentIndex() );
+			table->factorSpecies.push_back( r->getIndex() );
+			table->factorKind.push_back( (unsigned char)kind );
+			table->factorRate.push_back( *f );
+		}
+		factorEnd = (uint)table->factorSpecies.size();
+	}
+
+	// Recognize the mass-action shapes in a single compartment
+	shape = SHAPE_GENERAL;
+	uint factors = factorEnd - factorBegin;
+	if( flatH && factors <= 2 ) {
+		bool local = true;
+		for( uint i = 0; i < factors; i++ ) {
+			local = local && table->factorCompartment[factorBegin + i] == 0;
+			shapeSpecies[i] = table->factorSpecies[factorBegin + i];
+		}
+		unsigned char first = factors > 0 ? table->factorKind[factorBegin] : 0;
+		unsigned char second = factors > 1 ? table->factorKind[factorBegin + 1] : 0;
+		if( !local )
+			shape = SHAPE_GENERAL;
+		else if( factors == 0 )
+			shape = SHAPE_ZEROTH;
+		else if( factors == 1 && first == FlatTable::RATE_LINEAR )
+			shape = SHAPE_FIRST;
+		else if( factors == 1 && first == FlatTable::RATE_GILH2 )
+			shape = SHAPE_DIMER;
+		else if( factors == 2 && first == FlatTable::RATE_LINEAR && second == FlatTable::RATE_LINEAR )
+			shape = SHAPE_SECOND;
+	}
+
+	changeBegin = (uint)table->changeSpecies.size();
+	for( Reactant *r = firstReactant; r; r = r->getNext() ) {
+		table->changeCompartment.push_back( r->getCompartmentIndex() );
+		table->changeSpecies.push_back( r->getIndex() );
+		table->changeAmount.push_back( -r->getConsumes() );
+		table->changeDelayed.push_back( NULL );
+	}
+	for( Product *p = firstProduct; p; p = p->getNext() ) {
+		table->changeCompartment.push_back( p->destCompartment );
+		table->changeSpecies.push_back( p->destIndex );
+		table->changeAmount.push_back( p->produces );
+		table->changeDelayed.push_back( p->tau.isZero() ? NULL : p );
+	}
+	changeEnd = (uint)table->changeSpecies.size();
+}
+
+// ---------------------------------------------------------------------------
+void Template::setNativeHEvaluator( HEvaluator eval ) {
+	assert( hasDefaultHEvaluator() );
+	hEval = eval;
+	nativeH = true;
+	flatH = false;
+}
+
+// ---------------------------------------------------------------------------
+void FlatTable::clear() throw() {
+	factorCompartment.clear();
+	factorSpecies.clear();
+	factorKind.clear();
+	factorRate.clear();
+	changeCompartment.clear();
+	changeSpecies.clear();
+	changeAmount.clear();
+	changeDelayed.clear();
+}
+
 // ---------------------------------------------------------------------------
 double SGNS_FASTCALL Template::default_hEval( Compartment **context, Reactant *r ) {
 	double h = 1.0;
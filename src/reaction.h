@@ -38,17 +38,32 @@ Product class contents:
 Template class contents:
 	- Represents a reaction (not bound to any specific compartment)
 	- Stores Reactants, Products and stochastic constants
+	- Stores which simulation engine its instances are handed to
+
+FlatTable class contents:
+	- Structure-of-arrays form of the reactants and products of all the
+	  reactions in a bank, built once the bank is complete
+	- Evaluates the default H-function and executes reactions by looping
+	  over contiguous ranges of the tables
 
 TemplateStoich class contents:
 	- Stoichiometry object to insert into a ReactionInstance which redirects
 	  all calls to a reaction::Template class
+
+MassActionStoich class contents:
+	- Stoichiometry object for single-compartment reactions of the common
+	  mass-action shapes, specialized on the shape at compile time
+	- Evaluates the propensity inline from species indices and the
+	  stochastic constant stored in the object
 */
 
 #ifndef REACTION_H
 #define REACTION_H
 
 #include <climits>
+#include <cmath>
 #include <deque>
+#include <vector>
 
 #include "simtypes.h"
 #include "simulation.h"
@@ -63,8 +78,11 @@ namespace sgns2 {
 namespace reaction {
 
 class Template;
+class FlatTable;
 template< uint C >
 class TemplateStoich;
+template< int Shape >
+class MassActionStoich;
 
 // ===========================================================================
 class Reactant {
@@ -125,16 +143,26 @@ public:
 	inline void setNext( Product *next ) throw() { this->next = next; }
 	// Access to the time delay
 	inline RuntimeDistribution *getTau() { return &tau; }
+	// Draw a time delay, from the blocks of the slot if it has one
+	inline double sampleTau( DistributionContext *dc ) {
+		return delaySlot != (uint)-1 ? dc->sampleDelay( &tau, delaySlot ) : tau.sample( dc ); }
+	// Give the delay a slot of its own among the blocks of samples drawn
+	// ahead in each simulation. Only for delays which are not constant.
+	inline void setDelaySlot( uint slot ) { delaySlot = slot; }
 	// Access to the target compartment index
 	//inline uint getDestCompartmentIdx() const { return destCompartment; }
 	// Get the numebr of this product produced when the reaction occurs
 	inline int getProduces() const throw() { return produces; }
 	// Set the number of this product produced when the reaction occurs
 	inline void setProduces( int n ) throw() { produces = n; }
-		
+	// Get the index in the compartment of the species of this product
+	inline uint getIndex() const throw() { return destIndex; }
+
 private:
 	// Normal population product
 	RuntimeDistribution tau;
+	// Slot of the delay's samples, or (uint)-1 to draw them one at a time
+	uint delaySlot;
 	// Number of this molecule produced
 	int produces;
 	// Index in the TemplateStoich that this product is produced in
@@ -162,6 +190,30 @@ public:
 	// Instances for hierarchical NRM
 	typedef MarkovUmbrellaReactionInstance<TemplateStoich<1> > UmbrellaInstance;
 
+	// Shapes of propensity which have instances of their own
+	enum Shape {
+		SHAPE_GENERAL, // Anything else
+		SHAPE_ZEROTH, // c
+		SHAPE_FIRST, // c X
+		SHAPE_SECOND, // c X Y
+		SHAPE_DIMER // c X (X-1) / 2
+	};
+	typedef ReactionStoichInstance<MassActionStoich<SHAPE_ZEROTH> > ZerothOrderInstance;
+	typedef ReactionStoichInstance<MassActionStoich<SHAPE_FIRST> > FirstOrderInstance;
+	typedef ReactionStoichInstance<MassActionStoich<SHAPE_SECOND> > SecondOrderInstance;
+	typedef ReactionStoichInstance<MassActionStoich<SHAPE_DIMER> > DimerInstance;
+
+	// Simulation engines which can take over the instances of a reaction
+	enum Engine {
+		ENGINE_NRM, // Every instance is an event of its own (default)
+		ENGINE_CR, // Composition-rejection direct method, one group per compartment
+		ENGINE_PDM, // Partial-propensity direct method for mass-action reactions
+		ENGINE_TAU, // Adaptive explicit tau-leaping, one group per compartment
+		ENGINE_HYBRID, // Direct method with integration of the fast reactions
+		ENGINE_RSSA, // Rejection-based SSA with propensity bounds, one group per compartment
+		ENGINE_COUNT
+	};
+
 	class Extra {
 		// Extra actions that a template can do.. Could include:
 		//    Compartment construction/destruction
@@ -187,15 +239,34 @@ public:
 	void setC( double newC ) { c = newC; }
 
 	// Calculates the H-function for this reaction
-	inline double calcH( Compartment **context ) const throw() {
-		return hEval( context, firstReactant ); }
+	inline double calcH( Compartment **context ) const throw();
 	// Executes this reaction
 	void execute( Compartment **context ) const throw();
 	// Execures the Extra actions associated with this reaction
 	void executeExtra( Compartment **context ) const throw();
 
-	// Make a new instance of this reaction
-	ReactionInstance *instantiate( Compartment **in, ReactionInstance *umbrella = NULL ) const throw();
+	// Classes of instance that instantiate() makes
+	enum InstanceClass {
+		CLASS_MEMBER, // Member of the compartment's ReactionGroup
+		CLASS_UMBRELLA,
+		CLASS_FIRE_ONCE,
+		CLASS_ZEROTH_ORDER,
+		CLASS_FIRST_ORDER,
+		CLASS_SECOND_ORDER,
+		CLASS_DIMER,
+		CLASS_GENERAL,
+		CLASS_INTERFACE,
+		CLASS_THREE_WAY
+	};
+	// The class of this reaction's instances, known once it is compiled
+	// and its engine selected
+	InstanceClass getInstanceClass() const throw();
+	// Size of this reaction's instances, or 0 if the group allocates them
+	size_t getInstanceSize() const throw();
+
+	// Make a new instance of this reaction, in mem if given, which must be
+	// getInstanceSize() bytes. The caller begins the instance.
+	ReactionInstance *instantiate( Compartment **in, ReactionInstance *umbrella = NULL, void *mem = NULL ) const throw();
 	// Add this reaction's dependencies to the compartments
 	void addDependencies( Compartment **context, ReactionInstance *inst ) const throw();
 	// Remove this reaction's dependencies to the compartments
@@ -218,10 +289,38 @@ public:
 
 	// Is this an umbrella reaction?
 	inline bool isUmbrellaReaction() const { return isUmbrella; }
+	// Does this reaction destroy its compartment?
+	inline bool isFireOnceReaction() const { return firesOnce; }
+	// Does this reaction have any Extra actions?
+	inline bool hasExtras() const { return firstExtra != NULL; }
+	// Get the number of compartments this reaction spans
+	inline uint getCompartmentCount() const { return nCompartments; }
+
+	// Manage the engine which simulates instances of this reaction
+	// Only affects instances which are not yet created
+	inline Engine getEngine() const { return (Engine)engine; }
+	inline void setEngine( Engine e ) { engine = (unsigned char)e; }
 
 	// Overriding the H evaluator
 	typedef double (SGNS_FASTCALL *HEvaluator)( Compartment **context, Reactant *firstReactant );
 	inline void setHEvaluator( HEvaluator eval ) { hEval = eval; }
+	inline HEvaluator getHEvaluator() const { return hEval; }
+	// Is the H-function the product of the reactants' rate functions?
+	inline bool hasDefaultHEvaluator() const { return hEval == &default_hEval || nativeH; }
+	// Replaces the evaluation of the default H-function with natively
+	// compiled code. The reaction still counts as having the default one.
+	void setNativeHEvaluator( HEvaluator eval );
+
+	// Appends this reaction's reactants and products to the flat tables,
+	// which are used from then on. The reaction must not change afterwards.
+	void compile( FlatTable *table );
+	// Has the reaction been compiled into flat tables?
+	inline bool isCompiled() const { return flat != NULL; }
+	// Shape of the propensity, known once the reaction is compiled
+	inline Shape getShape() const { return (Shape)shape; }
+	// Species read by the propensity of a mass-action shape, in the order
+	// of their factors
+	inline uint getShapeSpecies( uint i ) const { return shapeSpecies[i]; }
 
 protected:
 	// The reaction's stochastic constant
@@ -235,6 +334,8 @@ protected:
 	// Umbrella reaction flag (some term is factored out) and fire-once
 	// flag (the reaction destroys the compartment)
 	bool isUmbrella, firesOnce;
+	// The engine which simulates instances of this reaction
+	unsigned char engine;
 	uint nCompartments;
 
 	// The default H-function is just the product of each reactant's rate
@@ -242,7 +343,96 @@ protected:
 	static double SGNS_FASTCALL default_hEval( Compartment **context, Reactant *firstReactant );
 	// The H-function of the reaction
 	HEvaluator hEval;
+
+	// The flat tables the reaction was compiled into, or NULL
+	FlatTable *flat;
+	// Are the reactants' rate functions evaluated from the flat tables?
+	bool flatH;
+	// Is hEval natively compiled code for the default H-function?
+	bool nativeH;
+	// Ranges of the reaction in the factor and change tables
+	uint factorBegin, factorEnd;
+	uint changeBegin, changeEnd;
+	// Shape of the propensity and the species it reads
+	unsigned char shape;
+	uint shapeSpecies[2];
 };
+
+// ===========================================================================
+// Reactants and products of a bank of reactions, one column per field
+class FlatTable {
+	friend class Template;
+public:
+	FlatTable() throw() { }
+	~FlatTable() throw() { }
+
+	// Empty the tables
+	void clear() throw();
+
+	// Product of the rate functions in the given range of factors
+	inline double calcH( Compartment **context, uint begin, uint end ) throw();
+	// Make the population changes in the given range of changes
+	inline void execute( Compartment **context, uint begin, uint end ) throw();
+
+private:
+	// The most common rate functions are evaluated inline
+	enum RateKind {
+		RATE_LINEAR,
+		RATE_GILH2,
+		RATE_OTHER
+	};
+
+	// Factors of the H-function. Unit rate functions are left out.
+	std::vector<uint> factorCompartment;
+	std::vector<uint> factorSpecies;
+	std::vector<unsigned char> factorKind;
+	std::vector<RateFunction> factorRate;
+
+	// Population changes, consumptions first, in the order the reaction
+	// makes them. Changes of zero are kept since they still trigger updates.
+	std::vector<uint> changeCompartment;
+	std::vector<uint> changeSpecies;
+	std::vector<int> changeAmount;
+	// Products with a delay are released through the Product, else NULL
+	std::vector<Product*> changeDelayed;
+};
+
+// ---------------------------------------------------------------------------
+inline double FlatTable::calcH( Compartment **context, uint begin, uint end ) throw() {
+	double h = 1.0;
+	for( uint i = begin; i < end; i++ ) {
+		Population X = context[factorCompartment[i]]->getPopulation( factorSpecies[i] );
+		switch( factorKind[i] ) {
+		case RATE_LINEAR:
+			h *= (double)X;
+			break;
+		case RATE_GILH2:
+			h *= fabs( (double)X * (double)(X-1) / 2.0 );
+			break;
+		default:
+			h *= factorRate[i].evaluate( X );
+			break;
+		}
+	}
+	return h;
+}
+
+// ---------------------------------------------------------------------------
+inline void FlatTable::execute( Compartment **context, uint begin, uint end ) throw() {
+	for( uint i = begin; i < end; i++ ) {
+		if( changeDelayed[i] )
+			changeDelayed[i]->release( context );
+		else
+			context[changeCompartment[i]]->modifyPopulation( changeSpecies[i], changeAmount[i] );
+	}
+}
+
+// ---------------------------------------------------------------------------
+inline double Template::calcH( Compartment **context ) const throw() {
+	if( flatH )
+		return flat->calcH( context, factorBegin, factorEnd );
+	return hEval( context, firstReactant );
+}
 	
 // ===========================================================================
 // General stochiometry classes which forward propensity calculations to
@@ -289,6 +479,72 @@ private:
 	Compartment *space[C];
 };
 
+// ===========================================================================
+// Stoichiometry for the mass-action shapes. Multiplies in the same order as
+// the H-function, so that the propensities are exactly those of a
+// TemplateStoich.
+template< int Shape >
+class MassActionStoich {
+public:
+	MassActionStoich( const Template *rxn, Compartment **ctx ) throw()
+		: c(rxn->getC()), tmplate(rxn), space(ctx[0])
+		, x(rxn->getShapeSpecies( 0 )), y(rxn->getShapeSpecies( 1 )) { }
+	~MassActionStoich() throw() { }
+
+	inline void destroy( ReactionInstance *inst ) {
+		tmplate->removeDependencies( &space, inst );
+	}
+
+	inline double calcMarkovA();
+
+	inline void doReaction() {
+		tmplate->execute( &space );
+	}
+
+	inline void doReactionExtra() {
+		tmplate->executeExtra( &space );
+	}
+
+	inline Compartment **getContext() {
+		return &space;
+	}
+
+	inline RNG::RNG *getRNG() {
+		return space->getSimulation()->getRNG();
+	}
+
+private:
+	double c; // The reaction rate
+	const Template *tmplate;
+	Compartment *space;
+	uint x, y; // The species in the propensity
+};
+
+// ---------------------------------------------------------------------------
+template<>
+inline double MassActionStoich<Template::SHAPE_ZEROTH>::calcMarkovA() {
+	return c;
+}
+
+// ---------------------------------------------------------------------------
+template<>
+inline double MassActionStoich<Template::SHAPE_FIRST>::calcMarkovA() {
+	return c * (double)space->getPopulation( x );
+}
+
+// ---------------------------------------------------------------------------
+template<>
+inline double MassActionStoich<Template::SHAPE_SECOND>::calcMarkovA() {
+	return c * ((double)space->getPopulation( x ) * (double)space->getPopulation( y ));
+}
+
+// ---------------------------------------------------------------------------
+template<>
+inline double MassActionStoich<Template::SHAPE_DIMER>::calcMarkovA() {
+	Population X = space->getPopulation( x );
+	return c * fabs( (double)X * (double)(X-1) / 2.0 );
+}
+
 } // namespace reaction
 } // namespace sgns2
 
@@ -3,7 +3,11 @@
 
 #include "stdafx.h"
 
+#include <new>
+
 #include "reactionbank.h"
+#include "quasiequilibrium.h"
+#include "reactiongroup.h"
 
 namespace sgns2 {
 namespace reaction {
@@ -27,6 +31,7 @@ void BankTemplate::seal() {
 
 // ---------------------------------------------------------------------------
 BankInstance::BankInstance()
+: instances(NULL), slab(NULL)
 {
 }
 
@@ -37,32 +42,48 @@ BankInstance::~BankInstance() {
 
 // ---------------------------------------------------------------------------
 IntraBankTemplate::IntraBankTemplate()
+: slabSize(0)
 {
 }
 
 // ---------------------------------------------------------------------------
 IntraBankTemplate::~IntraBankTemplate() {
 	assert( instances == 0 || isSealed() );
+	for( uint i = 0; i < templates.size(); i++ )
+		delete templates[i].pair;
 }
 
 // ---------------------------------------------------------------------------
 BankInstance *IntraBankTemplate::instantiate( Compartment *in, BankInstance **context ) {
-	assert( isSealed() );
+	assert( isSealed() && slabOffsets.size() == templates.size() );
 
 	BankInstance *bi = new BankInstance;
 	bi->tmplate = this;
-	bi->instances = new ReactionInstance*[getReactionCount()];
+	bi->instances = new ReactionInstance*[getReactionCount() + 1];
+	bi->slab = slabSize ? static_cast<char*>(operator new( slabSize )) : NULL;
 
 	for( uint i = 0; i < templates.size(); i++ ) {
-		if( templates[i].umbrellaId == (uint)-1 ) {
+		void *mem = slabOffsets[i] != (size_t)-1 ? bi->slab + slabOffsets[i] : NULL;
+		if( templates[i].pairedWith != (uint)-1 ) {
+			// Folded pair, simulated by a single instance
+			bi->instances[i] = NULL;
+			if( templates[i].pair ) {
+				bi->instances[i] = new (mem) QuasiEquilibrium( in, templates[i].pair );
+				bi->instances[i]->begin();
+			}
+			continue;
+		} else if( templates[i].umbrellaId == (uint)-1 ) {
 			// Free reaction
-			bi->instances[i] = templates[i].tmplate.instantiate( &in );
+			bi->instances[i] = templates[i].tmplate.instantiate( &in, NULL, mem );
 		} else {
 			// sub-reaction
-			bi->instances[i] = templates[i].tmplate.instantiate( &in, context[templates[i].parentBankId]->getReactionInstance( templates[i].umbrellaId ) );
+			bi->instances[i] = templates[i].tmplate.instantiate( &in, context[templates[i].parentBankId]->getReactionInstance( templates[i].umbrellaId ), mem );
 		}
 		bi->instances[i]->begin();
 	}
+	// The group stands in for the reactions it simulates in the
+	// compartment's dependencies
+	bi->instances[templates.size()] = in->getReactionGroup();
 
 	instances++;
 
@@ -73,13 +94,147 @@ BankInstance *IntraBankTemplate::instantiate( Compartment *in, BankInstance **co
 void IntraBankTemplate::destroyInstance( BankInstance *bi ) {
 	assert( bi->tmplate == this );
 
-	for( uint i = 0; i < templates.size(); i++ )
-		delete bi->instances[i];
+	for( uint i = 0; i < templates.size(); i++ ) {
+		if( slabOffsets[i] == (size_t)-1 )
+			delete bi->instances[i];
+		else if( bi->instances[i] )
+			bi->instances[i]->~ReactionInstance();
+	}
 	delete[] bi->instances;
+	operator delete( bi->slab );
 
 	instances--;
 }
 
+// ---------------------------------------------------------------------------
+void IntraBankTemplate::layOutInstances() {
+	// Every instance starts on a boundary suitable for any of its members
+
+	assert( isSealed() );
+
+	slabOffsets.assign( templates.size(), (size_t)-1 );
+	slabSize = 0;
+	for( uint i = 0; i < templates.size(); i++ ) {
+		size_t size;
+		if( templates[i].pairedWith != (uint)-1 )
+			size = templates[i].pair ? sizeof(QuasiEquilibrium) : 0;
+		else
+			size = templates[i].tmplate.getInstanceSize();
+		if( !size )
+			continue;
+		slabOffsets[i] = slabSize;
+		slabSize += (size + SLAB_ALIGNMENT - 1) / SLAB_ALIGNMENT * SLAB_ALIGNMENT;
+	}
+}
+
+// ---------------------------------------------------------------------------
+size_t IntraBankTemplate::getInstanceMemory() const {
+	return sizeof( BankInstance ) + (templates.size() + 1) * sizeof( ReactionInstance* ) + slabSize;
+}
+
+// ---------------------------------------------------------------------------
+uint IntraBankTemplate::selectEngine( Template::Engine engine ) {
+	// Sub-reactions stay under their umbrellas
+
+	uint count = 0;
+	for( uint i = 0; i < templates.size(); i++ ) {
+		Template &tmplate = templates[i].tmplate;
+		if( templates[i].umbrellaId == (uint)-1 && templates[i].pairedWith == (uint)-1 && ReactionGroup::accepts( engine, &tmplate ) ) {
+			tmplate.setEngine( engine );
+			count++;
+		} else {
+			tmplate.setEngine( Template::ENGINE_NRM );
+		}
+	}
+	return count;
+}
+
+// ---------------------------------------------------------------------------
+void IntraBankTemplate::compile() {
+	table.clear();
+	for( uint i = 0; i < templates.size(); i++ )
+		templates[i].tmplate.compile( &table );
+}
+
+// ---------------------------------------------------------------------------
+bool IntraBankTemplate::canFoldPair( uint forward, uint reverse ) {
+	QuasiEquilibrium::Pair pair;
+	if( forward == reverse ||
+		templates[forward].umbrellaId != (uint)-1 || templates[forward].pairedWith != (uint)-1 ||
+		templates[reverse].umbrellaId != (uint)-1 || templates[reverse].pairedWith != (uint)-1 ||
+		!QuasiEquilibrium::describePair( &templates[forward].tmplate, &templates[reverse].tmplate, pair ) )
+		return false;
+
+	// A reaction spanning compartments is split into one template per
+	// level, each in the bank of its compartment type and reading only its
+	// own compartment, so every reaction reading the species is in this bank
+	for( uint i = 0; i < templates.size(); i++ ) {
+		if( i == forward || i == reverse )
+			continue;
+		if( templates[i].pairedWith != (uint)-1 ) {
+			// Two pairs would redraw the same species
+			if( reads( &templates[i].tmplate, pair ) )
+				return false;
+		} else if( !QuasiEquilibrium::canRewrite( &templates[i].tmplate, pair ) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+bool IntraBankTemplate::findFastPair( uint &forward, uint &reverse, double separation ) {
+	QuasiEquilibrium::Pair pair;
+	for( uint f = 0; f < templates.size(); f++ ) {
+		// The reverse reaction consumes the single product of the forward one
+		Product *prod = templates[f].tmplate.getFirstProduct();
+		if( templates[f].pairedWith != (uint)-1 || !prod || prod->getNext() )
+			continue;
+		for( uint r = 0; r < templates.size(); r++ ) {
+			Reactant *first = templates[r].tmplate.getFirstReactant();
+			if( !first || first->getIndex() != prod->getIndex() || !canFoldPair( f, r ) )
+				continue;
+
+			QuasiEquilibrium::describePair( &templates[f].tmplate, &templates[r].tmplate, pair );
+			double slowest = std::min( templates[f].tmplate.getC(), templates[r].tmplate.getC() );
+			bool fast = true;
+			for( uint i = 0; i < templates.size() && fast; i++ ) {
+				const Template *t = &templates[i].tmplate;
+				if( i != f && i != r && reads( t, pair ) && t->getC() * separation > slowest )
+					fast = false;
+			}
+			if( fast ) {
+				forward = f;
+				reverse = r;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// ---------------------------------------------------------------------------
+void IntraBankTemplate::foldPair( uint forward, uint reverse, QuasiEquilibrium::Pair *pair ) {
+	assert( !isSealed() && canFoldPair( forward, reverse ) );
+
+	templates[forward].pairedWith = reverse;
+	templates[forward].pair = pair;
+	templates[reverse].pairedWith = forward;
+	for( uint i = 0; i < templates.size(); i++ ) {
+		if( templates[i].pairedWith == (uint)-1 )
+			QuasiEquilibrium::rewrite( &templates[i].tmplate, pair );
+	}
+}
+
+// ---------------------------------------------------------------------------
+bool IntraBankTemplate::reads( const Template *tmplate, const QuasiEquilibrium::Pair &pair ) {
+	for( Reactant *r = tmplate->getFirstReactant(); r; r = r->getNext() ) {
+		if( pair.involves( r->getIndex() ) )
+			return true;
+	}
+	return false;
+}
+
 // ---------------------------------------------------------------------------
 uint IntraBankTemplate::createReaction( uint parentBank, uint umbrellaId, bool umbrella, bool fireOnce ) {
 	assert( !isSealed() );
@@ -40,6 +40,9 @@ IntraBankTemplate class contents:
 	- Contains the collection of reactions that can occur within a
 	  single compartment (some may be Umbrella reactions and therefore can
 	  span multiple compartments)
+	- Folds fast reversible pairs of reactions into a QuasiEquilibrium
+	- Compiles its reactions into a FlatTable once the bank is complete
+	- Lays the instances of its reactions out in a single slab of memory
 */
 
 #ifndef REACTIONBANK_H
@@ -47,6 +50,7 @@ IntraBankTemplate class contents:
 
 #include "reactioninstance.h"
 #include "reaction.h"
+#include "quasiequilibrium.h"
 #include "rng.h"
 #include "simplesll.h"
 
@@ -81,6 +85,9 @@ public:
 
 	// Access to an individual ReactionInstance
 	ReactionInstance *getReactionInstance( uint index ) { return instances[index]; }
+	// The ReactionInstances of the bank, followed by the compartment's
+	// ReactionGroup (either may be NULL)
+	ReactionInstance **getReactionInstances() { return instances; }
 
 private:
 	// To be called by one of the friend classes
@@ -88,8 +95,10 @@ private:
 
 	// The template upon which this instance is based
 	BankTemplate *tmplate;
-	// The list of ReactionInstances in this bank
+	// The list of ReactionInstances in this bank, plus the group
 	ReactionInstance **instances;
+	// Memory holding all the instances the bank allocates itself
+	char *slab;
 };
 
 // ===========================================================================
@@ -111,11 +120,38 @@ public:
 	uint createReaction( uint parentBank = 0, uint umbrellaId = (uint)-1, bool umbrella = false, bool fireOnce = false );
 	// Access to a given reaction's template
 	inline Template *getReactionTemplate( uint id ) { return &templates[id].tmplate; }
+	// Hands all free reactions that the engine can simulate over to it
+	// Returns the number of reactions handed over
+	uint selectEngine( Template::Engine engine );
+	// Lowers all the reactions into the bank's flat tables. To be called
+	// once no more reactions are added or changed.
+	void compile();
+	// Lays the instances of the reactions out in a single slab of memory.
+	// To be called once the bank is sealed and its engines selected.
+	void layOutInstances();
+	// Bytes held by each instance of the bank, not counting the reactions
+	// allocated outside of the slab
+	size_t getInstanceMemory() const;
+
+	// Can the two reactions be folded into a quasi-equilibrium? They must be
+	// a reversible pair S -> C, C -> S (see QuasiEquilibrium::describePair),
+	// the propensities of all the other reactions reading their species must
+	// be mass-action and no other folded pair may read them
+	bool canFoldPair( uint forward, uint reverse );
+	// Finds a pair which can be folded and whose stochastic constants are
+	// both at least separation times those of all the other reactions
+	// reading their species. Returns false if there are none.
+	bool findFastPair( uint &forward, uint &reverse, double separation );
+	// Folds the pair into a quasi-equilibrium and rewrites the reactions
+	// reading its species. pair describes the two reactions, with the
+	// hidden species for its totals filled in, and is owned by the bank.
+	void foldPair( uint forward, uint reverse, QuasiEquilibrium::Pair *pair );
 
 private:
 	struct TargettedTemplate {
 		TargettedTemplate( uint umbrellaId, uint parentBankId, bool isUmbrella, bool fireOnce )
-			: parentBankId(parentBankId), umbrellaId(umbrellaId), tmplate(isUmbrella, fireOnce)
+			: parentBankId(parentBankId), umbrellaId(umbrellaId)
+			, pairedWith((uint)-1), pair(NULL), tmplate(isUmbrella, fireOnce)
 		{ }
 
 		// Index in the instantiation context for the bank from which
@@ -123,6 +159,11 @@ private:
 		uint parentBankId;
 		// Index of the umbrella reaction in the parent bank
 		uint umbrellaId;
+		// Index of the other reaction of a folded pair, or (uint)-1
+		uint pairedWith;
+		// Description of a folded pair, set in the forward reaction only,
+		// which instantiates the pair's QuasiEquilibrium
+		QuasiEquilibrium::Pair *pair;
 		// The reaction's template
 		reaction::Template tmplate;
 	};
@@ -130,6 +171,17 @@ private:
 	// The reactions in this bank
 	typedef std::vector< TargettedTemplate > Templates;
 	Templates templates;
+	// Flat form of the reactions, filled in by compile()
+	FlatTable table;
+	// Instances in the slab are aligned as operator new would align them
+	enum { SLAB_ALIGNMENT = 16 };
+	// Offset of each reaction's instance in the slab, or (size_t)-1 if it
+	// is allocated elsewhere, and the size of the slab
+	std::vector< size_t > slabOffsets;
+	size_t slabSize;
+
+	// Does the reaction read any of the pair's species?
+	static bool reads( const Template *tmplate, const QuasiEquilibrium::Pair &pair );
 };
 
 } // namespace reaction
@@ -0,0 +1,146 @@
+// See reactiongroup.h for a description of the contents of this file.
+
+#include "stdafx.h"
+
+#include <cstring>
+
+#include "compositionrejection.h"
+#include "hybrid.h"
+#include "partialpropensity.h"
+#include "reactiongroup.h"
+#include "rejectionssa.h"
+#include "tauleap.h"
+
+namespace sgns2 {
+
+static const char *engineNames[reaction::Template::ENGINE_COUNT] = {
+	"nrm", "cr", "pdm", "tau", "hybrid", "rssa"
+};
+
+// ---------------------------------------------------------------------------
+ReactionGroup::ReactionGroup( Compartment *in, Engine engine ) throw()
+: ReactionInstance( in )
+, compartment(in)
+, totalA(0.0)
+, nextT(std::numeric_limits<double>::infinity())
+, engine(engine)
+, updSelf(false)
+{
+}
+
+// ---------------------------------------------------------------------------
+ReactionGroup::~ReactionGroup() throw() {
+}
+
+// ---------------------------------------------------------------------------
+const char *ReactionGroup::getEngineName( Engine e ) throw() {
+	return e < reaction::Template::ENGINE_COUNT ? engineNames[e] : "?";
+}
+
+// ---------------------------------------------------------------------------
+bool ReactionGroup::findEngine( const char *name, Engine &e ) throw() {
+	for( uint i = 0; i < reaction::Template::ENGINE_COUNT; i++ ) {
+		if( 0 == strcmp( name, engineNames[i] ) ) {
+			e = (Engine)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// ---------------------------------------------------------------------------
+bool ReactionGroup::accepts( Engine e, const reaction::Template *tmplate ) throw() {
+	// Umbrella, compartment-destroying and multi-compartment reactions, and
+	// reactions with Extra actions, always stay with the NRM
+	if( tmplate->isUmbrellaReaction() || tmplate->isFireOnceReaction()
+		|| tmplate->hasExtras() || tmplate->getCompartmentCount() > 1 )
+		return false;
+
+	switch( e ) {
+	case reaction::Template::ENGINE_CR:
+	case reaction::Template::ENGINE_TAU:
+	case reaction::Template::ENGINE_HYBRID:
+	case reaction::Template::ENGINE_RSSA:
+		return true;
+	case reaction::Template::ENGINE_PDM:
+		return PartialPropensityGroup::isMassAction( tmplate );
+	default:
+		return false;
+	}
+}
+
+// ---------------------------------------------------------------------------
+ReactionGroup *ReactionGroup::create( Engine e, Compartment *in ) {
+	ReactionGroup *group = NULL;
+	switch( e ) {
+	case reaction::Template::ENGINE_CR:
+		group = new CompositionRejectionGroup( in );
+		break;
+	case reaction::Template::ENGINE_PDM:
+		group = new PartialPropensityGroup( in );
+		break;
+	case reaction::Template::ENGINE_TAU:
+		group = new TauLeapGroup( in );
+		break;
+	case reaction::Template::ENGINE_HYBRID:
+		group = new HybridGroup( in );
+		break;
+	case reaction::Template::ENGINE_RSSA:
+		group = new RejectionSSAGroup( in );
+		break;
+	default:
+		assert( false ); // The NRM does not use groups
+	}
+	group->begin();
+	return group;
+}
+
+// ---------------------------------------------------------------------------
+bool ReactionGroup::collectChanges( const reaction::Template *tmplate, std::vector<Change> &changes ) {
+	changes.clear();
+	bool delayed = false;
+	for( reaction::Reactant *r = tmplate->getFirstReactant(); r; r = r->getNext() )
+		addChange( changes, r->getIndex(), -r->getConsumes() );
+	for( reaction::Product *p = tmplate->getFirstProduct(); p; p = p->getNext() ) {
+		if( p->getTau()->isZero() )
+			addChange( changes, p->getIndex(), p->getProduces() );
+		else
+			delayed = true;
+	}
+
+	// Drop the changes which cancel out
+	size_t n = 0;
+	for( size_t i = 0; i < changes.size(); i++ ) {
+		if( changes[i].amount != 0 )
+			changes[n++] = changes[i];
+	}
+	changes.resize( n );
+	return delayed;
+}
+
+// ---------------------------------------------------------------------------
+void ReactionGroup::addChange( std::vector<Change> &changes, uint species, int amount ) {
+	for( size_t i = 0; i < changes.size(); i++ ) {
+		if( changes[i].species == species ) {
+			changes[i].amount += amount;
+			return;
+		}
+	}
+	Change ch = { species, amount };
+	changes.push_back( ch );
+}
+
+// ---------------------------------------------------------------------------
+void ReactionGroup::begin() throw() {
+	updSelf = false;
+	totalA = 0.0;
+	nextT = std::numeric_limits<double>::infinity();
+	dequeue();
+}
+
+// ---------------------------------------------------------------------------
+void ReactionGroup::popUpdate( uint ) throw() {
+	scheduleUpdate();
+}
+
+} // namespace sgns2
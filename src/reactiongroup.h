@@ -0,0 +1,175 @@
+/*
+Copyright (c) 2011, Jason Lloyd-Price, Abhishekh Gupta, and Andre S. Ribeiro
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of the contributors may not be used to endorse or promote
+	  products derived from this software without specific prior written
+	  permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/* reactiongroup.h/cpp
+
+ReactionGroup class contents:
+	- Abstract base class for the engines which simulate a set of reactions in
+	  a compartment as a single event in the compartment's queue, instead of
+	  queueing each reaction on its own (NRM)
+	- Manages the next firing time of the group from its total propensity
+	- Names and creates the engines selectable with the engine identifier
+
+GroupMember class contents:
+	- Implementation of ReactionInstance for reactions handed to a ReactionGroup
+	- Is never queued itself; forwards its updates to the group
+*/
+
+#ifndef REACTIONGROUP_H
+#define REACTIONGROUP_H
+
+#include <cassert>
+#include <cfloat>
+#include <limits>
+#include <vector>
+
+#include "reactioninstance.h"
+#include "reaction.h"
+#include "compartment.h"
+
+namespace sgns2 {
+
+class GroupMember;
+
+// ===========================================================================
+class ReactionGroup : public ReactionInstance {
+public:
+	typedef reaction::Template::Engine Engine;
+
+	ReactionGroup( Compartment *in, Engine engine ) throw();
+	virtual ~ReactionGroup() throw();
+
+	// Engine names, as used by the engine identifier
+	static const char *getEngineName( Engine e ) throw();
+	static bool findEngine( const char *name, Engine &e ) throw();
+	// Can the given engine simulate the reaction?
+	// Only free reactions (not under an umbrella) are ever offered.
+	static bool accepts( Engine e, const reaction::Template *tmplate ) throw();
+	// Create a new, empty group for the given engine
+	static ReactionGroup *create( Engine e, Compartment *in );
+
+	// Net change in a species when a reaction fires once
+	struct Change {
+		uint species;
+		int amount;
+	};
+	// Collects the non-zero net changes of a reaction by species. Delayed
+	// products go to the wait list, so are left out. Returns true if the
+	// reaction has any delayed products.
+	static bool collectChanges( const reaction::Template *tmplate, std::vector<Change> &changes );
+
+	// Get the engine that this group implements
+	inline Engine getEngine() const throw() { return engine; }
+	// Get the compartment that the group's reactions occur in
+	inline Compartment *getCompartment() const throw() { return compartment; }
+
+	// Adds a new instance of the given reaction to the group
+	virtual GroupMember *newMember( const reaction::Template *tmplate ) = 0;
+	// Removes a member from the group. Must be called by the destructor of
+	// the engine's GroupMember class.
+	virtual void removeMember( GroupMember *member ) throw() = 0;
+	// The propensity of the member may have changed
+	virtual void touch( GroupMember *member ) throw() = 0;
+
+	// The group is dormant until its first member is touched
+	virtual void begin() throw();
+	// Schedules an update of the group
+	virtual void popUpdate( uint cookie ) throw();
+
+protected:
+	// Schedules the group for an update() call, if it is not already
+	inline void scheduleUpdate() throw() {
+		if( !updSelf ) {
+			updSelf = true;
+			scheduleForUpdate();
+		}
+	}
+	// Sets the next firing time of the group from its new total propensity
+	// If redraw is false, the remaining time is rescaled as in step 5 of
+	// Gibson and Bruck (1999). Otherwise, a new random number is used.
+	inline void reschedule( double t, double newA, bool redraw ) throw() {
+		if( !redraw && totalA > 0.0 ) {
+			if( newA == totalA )
+				return;
+			nextT = t + (nextT - t + DBL_MIN) * totalA / newA;
+		} else if( newA > 0.0 ) {
+			nextT = t + getRNG()->exponential( newA );
+		} else {
+			nextT = std::numeric_limits<double>::infinity();
+		}
+		totalA = newA;
+		schedule( nextT );
+	}
+	inline RNG::RNG *getRNG() throw() { return compartment->getSimulation()->getRNG(); }
+	// Adds to the net change of a species, for collectChanges
+	static void addChange( std::vector<Change> &changes, uint species, int amount );
+
+	// The compartment the group's reactions occur in. Also the context passed to the
+	// member reactions' templates.
+	Compartment *compartment;
+	// Total propensity at the last reschedule
+	double totalA;
+	// The current next firing time of the group
+	double nextT;
+	// The engine implemented by the group
+	Engine engine;
+	// Set when the group is already scheduled for an update
+	bool updSelf;
+};
+
+// ===========================================================================
+class GroupMember : public ReactionInstance {
+public:
+	GroupMember( ReactionGroup *group, const reaction::Template *tmplate ) throw()
+		: ReactionInstance( group->getCompartment() ), group(group), tmplate(tmplate), slot(0) { }
+	virtual ~GroupMember() throw() { }
+
+	// Reports the initial propensity to the group
+	virtual void begin() throw() { group->touch( this ); }
+	// Members are never queued, so are never triggered
+	virtual void trigger() throw() { assert( false ); }
+	// Forwards the update to the group
+	virtual void popUpdate( uint ) throw() { group->touch( this ); }
+	// All of the work is done in the group's update
+	virtual void update() throw() { }
+
+	// Access to the group the member belongs to
+	inline ReactionGroup *getGroup() const throw() { return group; }
+	// Access to the member's reaction
+	inline const reaction::Template *getTemplate() const throw() { return tmplate; }
+	// Access to the member's position within the group, as used by the engine
+	inline uint getSlot() const throw() { return slot; }
+	inline void setSlot( uint newSlot ) throw() { slot = newSlot; }
+
+private:
+	ReactionGroup *group;
+	const reaction::Template *tmplate;
+	uint slot;
+};
+
+} // namespace sgns2
+
+#endif // REACTIONGROUP_H
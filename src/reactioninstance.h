@@ -33,6 +33,7 @@ ReactionInstance class contents:
 ReactionStoichInstance class contents:
 	- Implementation of ReactionInstance
 	- Manages the next reaction firing time
+	- Stays out of the queue (dormant) while its propensity is zero
 	- Contains a Stoichiometry object which determines how the propensity of the
 	  reaction is calculated and what happens when the reaction is executed
 	- Contains a Tau object which determines how the next reaction time
@@ -83,6 +84,8 @@ public:
 
 	// Additional functions expected of a reaction EventStream
 	virtual void begin() throw() = 0;
+	// Called when the population of a species the reaction depends on changes
+	// The cookie is the index of the species in its compartment
 	virtual void popUpdate( uint cookie ) throw() = 0;
 };
 
@@ -105,7 +108,7 @@ public:
 	// Enqueues the reaction for the first time
 	virtual void begin() throw() {
 		updSelf = false;
-		enqueue( tau.newNextTime( getQueue()->getUpdatedBaseTime(), stoich ) );
+		schedule( tau.newNextTime( getQueue()->getUpdatedBaseTime(), stoich ) );
 		assert( getNextEventTime() >= getQueue()->getBaseTime() );
 	}
 	// Performs the reaction step
@@ -113,7 +116,7 @@ public:
 		// Perform the reaction
 		updSelf = true;
 		stoich.doReaction();
-		enqueue( tau.newNextTime( getQueue()->getBaseTime(), stoich ) );
+		schedule( tau.newNextTime( getQueue()->getBaseTime(), stoich ) );
 		assert( getNextEventTime() >= getQueue()->getBaseTime() );
 		updSelf = false;
 
@@ -130,7 +133,7 @@ public:
 	// Update the next time based on the changed propensities
 	virtual void update() throw() {
 		updSelf = false;
-		enqueue( tau.updateNextTime( getQueue()->getUpdatedBaseTime(), stoich ) );
+		schedule( tau.updateNextTime( getQueue()->getUpdatedBaseTime(), stoich ) );
 		assert( getNextEventTime() >= getQueue()->getBaseTime() );
 	}
 
@@ -239,7 +242,8 @@ public:
 		setBaseTime( lastBaseT );
 		oldA = stoich.calcMarkovA();
 		assert( !(oldA < 0.0) );
-		enqueue( std::numeric_limits<double>::infinity() );
+		// Dormant until something is scheduled under the umbrella
+		dequeue();
 	}
 
 	// Performs the reaction and update steps
@@ -255,7 +259,7 @@ public:
 		// Simply perform the next event in this queue's list
 		// The bubble up/down of the event will call newMinHeap,
 		// keeping the umbrella up-to-date
-		((EventStream*)getNextEvent())->trigger();
+		dispatchTrigger( (EventStream*)getNextEvent() );
 	}
 
 	// Updates the propensity of the reaction and the next time
@@ -294,9 +298,9 @@ protected:
 		if( oldA > 0.0 ) {
 			double dt = EventStreamQueue::getNextEventTime() - getBaseTime();
 			assert( dt >= 0.0 );
-			enqueue( lastBaseT + dt / oldA );
+			schedule( lastBaseT + dt / oldA );
 		} else {
-			enqueue( std::numeric_limits<double>::infinity() );
+			dequeue();
 		}
 	}
 	inline void newMinHeap_inl() throw() {
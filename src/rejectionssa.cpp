@@ -0,0 +1,268 @@
+// See rejectionssa.h for a description of the contents of this file.
+
+#include "stdafx.h"
+
+#include <algorithm>
+
+#include "rejectionssa.h"
+
+namespace sgns2 {
+
+using reaction::Reactant;
+
+double RejectionSSAGroup::delta = 0.1;
+
+// ---------------------------------------------------------------------------
+RejectionSSAGroup::RejectionSSAGroup( Compartment *in ) throw()
+: ReactionGroup( in, reaction::Template::ENGINE_RSSA )
+, tree(2, 0.0)
+, treeCapacity(1)
+{
+}
+
+// ---------------------------------------------------------------------------
+RejectionSSAGroup::~RejectionSSAGroup() throw() {
+	assert( members.empty() ); // All members must be destroyed first
+}
+
+// ---------------------------------------------------------------------------
+GroupMember *RejectionSSAGroup::newMember( const reaction::Template *tmplate ) {
+	Member *m = new Member( this, tmplate );
+	if( m->exact ) {
+		// Depend on the reactants exactly as NRM reactions do
+		tmplate->addDependencies( &compartment, m );
+	} else {
+		// Reactants with the unit rate function do not change the propensity
+		for( Reactant *r = tmplate->getFirstReactant(); r; r = r->getNext() ) {
+			if( r->getRateFunction()->isUnit() )
+				continue;
+			uint index = r->getIndex();
+			watch( index );
+			std::vector<Member*> &readers = species[index].readers;
+			if( readers.empty() || readers.back() != m )
+				readers.push_back( m );
+		}
+	}
+
+	m->setSlot( (uint)members.size() );
+	members.push_back( m );
+	if( members.size() > treeCapacity ) {
+		// Double the sum tree
+		uint capacity = treeCapacity * 2;
+		std::vector<double> newTree( 2 * capacity, 0.0 );
+		for( uint i = 0; i < treeCapacity; i++ )
+			newTree[capacity + i] = tree[treeCapacity + i];
+		for( uint node = capacity - 1; node >= 1; node-- )
+			newTree[node] = newTree[2 * node] + newTree[2 * node + 1];
+		tree.swap( newTree );
+		treeCapacity = capacity;
+	}
+	return m;
+}
+
+// ---------------------------------------------------------------------------
+void RejectionSSAGroup::removeMember( GroupMember *member ) throw() {
+	Member *m = static_cast<Member*>(member);
+
+	if( m->exact ) {
+		m->getTemplate()->removeDependencies( &compartment, m );
+	} else {
+		for( Reactant *r = m->getTemplate()->getFirstReactant(); r; r = r->getNext() ) {
+			if( r->getRateFunction()->isUnit() )
+				continue;
+			uint index = r->getIndex();
+			std::vector<Member*> &readers = species[index].readers;
+			readers.erase( std::remove( readers.begin(), readers.end(), m ), readers.end() );
+			unwatch( index );
+		}
+	}
+
+	// Swap the last member into the removed member's slot
+	Member *last = members.back();
+	uint slot = m->getSlot();
+	last->setSlot( slot );
+	members[slot] = last;
+	members.pop_back();
+	setUpper( slot, last->upper );
+	setUpper( (uint)members.size(), 0.0 );
+
+	if( m->touched )
+		touchedList.erase( std::find( touchedList.begin(), touchedList.end(), m ) );
+
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void RejectionSSAGroup::touch( GroupMember *member ) throw() {
+	// Called by begin(), and by the exact members' reactants
+	Member *m = static_cast<Member*>(member);
+	if( !m->touched ) {
+		m->touched = true;
+		touchedList.push_back( m );
+	}
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void RejectionSSAGroup::popUpdate( uint index ) throw() {
+	// Nothing to do as long as the population stays within its interval
+	Species &s = species[index];
+	Population x = compartment->getPopulation( index );
+	if( x >= s.lower && x <= s.upper )
+		return;
+	if( !s.changed ) {
+		s.changed = true;
+		changedSpecies.push_back( index );
+	}
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void RejectionSSAGroup::trigger() throw() {
+	// Try a member chosen in proportion to its upper bound
+
+	double t = getQueue()->getBaseTime();
+	RNG::RNG *rng = getRNG();
+	// The changes made by the reaction are applied right here
+	bool wasScheduled = updSelf;
+	updSelf = true;
+
+	if( tree[1] > 0.0 ) {
+		// Choose the member by descending the sum tree
+		double r = rng->rand_halfclosed01() * tree[1];
+		uint node = 1;
+		while( node < treeCapacity ) {
+			node <<= 1;
+			if( r >= tree[node] && tree[node + 1] > 0.0 ) {
+				r -= tree[node];
+				node++;
+			}
+		}
+
+		// The exact propensity is only needed when the lower bound is not
+		// enough to accept the member
+		Member *m = members[node - treeCapacity];
+		double u = rng->rand_halfclosed01() * m->upper;
+		if( u < m->lower || (!m->exact && u < m->c * m->getTemplate()->calcH( &compartment )) )
+			m->getTemplate()->execute( &compartment );
+	}
+
+	flush();
+	reschedule( t, tree[1], true );
+	updSelf = wasScheduled;
+}
+
+// ---------------------------------------------------------------------------
+void RejectionSSAGroup::update() throw() {
+	updSelf = false;
+	flush();
+	reschedule( getQueue()->getUpdatedBaseTime(), tree[1], false );
+}
+
+// ---------------------------------------------------------------------------
+void RejectionSSAGroup::flush() throw() {
+	// Recalculates everything that has changed since the last flush
+
+	// Species which are still out of their interval get a new one around
+	// their population, which invalidates the bounds of their readers
+	for( size_t i = 0; i < changedSpecies.size(); i++ ) {
+		uint index = changedSpecies[i];
+		species[index].changed = false;
+		Population x = compartment->getPopulation( index );
+		if( x < species[index].lower || x > species[index].upper )
+			recenter( index );
+	}
+	changedSpecies.clear();
+
+	// calcBounds may touch more members as it goes
+	for( size_t i = 0; i < touchedList.size(); i++ ) {
+		Member *m = touchedList[i];
+		m->touched = false;
+		calcBounds( m );
+		setUpper( m->getSlot(), m->upper );
+	}
+	touchedList.clear();
+}
+
+// ---------------------------------------------------------------------------
+void RejectionSSAGroup::recenter( uint index ) throw() {
+	Species &s = species[index];
+	Population x = compartment->getPopulation( index );
+	if( x >= 0 ) {
+		Population w = std::max( (Population)(delta * (double)x), (Population)MIN_HALF_WIDTH );
+		s.lower = std::max( x - w, (Population)0 );
+		s.upper = x + w;
+	} else {
+		// The rate functions are only monotonic over non-negative populations
+		s.lower = s.upper = x;
+	}
+
+	for( size_t i = 0; i < s.readers.size(); i++ ) {
+		Member *m = s.readers[i];
+		if( !m->touched ) {
+			m->touched = true;
+			touchedList.push_back( m );
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+void RejectionSSAGroup::calcBounds( Member *m ) throw() {
+	if( m->exact ) {
+		double a = m->c * m->getTemplate()->calcH( &compartment );
+		m->lower = m->upper = a > 0.0 ? a : 0.0;
+		return;
+	}
+
+	// The propensity is c times the product of the reactants' rate
+	// functions, which are all monotonic, so each is bounded by its values
+	// at the ends of its species' interval
+	double lower = m->c, upper = m->c;
+	for( Reactant *r = m->getTemplate()->getFirstReactant(); r; r = r->getNext() ) {
+		RateFunction *f = r->getRateFunction();
+		if( f->isUnit() )
+			continue;
+		uint index = r->getIndex();
+		Species &s = species[index];
+		Population x = compartment->getPopulation( index );
+		if( x < s.lower || x > s.upper )
+			recenter( index ); // First reader of the species
+		double fl = f->evaluate( s.lower ), fu = f->evaluate( s.upper );
+		double p[4] = { lower * fl, lower * fu, upper * fl, upper * fu };
+		lower = *std::min_element( p, p + 4 );
+		upper = *std::max_element( p, p + 4 );
+	}
+	m->lower = lower > 0.0 ? lower : 0.0;
+	m->upper = upper > 0.0 ? upper : 0.0;
+}
+
+// ---------------------------------------------------------------------------
+void RejectionSSAGroup::setUpper( uint slot, double a ) throw() {
+	uint node = treeCapacity + slot;
+	tree[node] = a;
+	while( node > 1 ) {
+		node >>= 1;
+		tree[node] = tree[2 * node] + tree[2 * node + 1];
+	}
+}
+
+// ---------------------------------------------------------------------------
+RejectionSSAGroup::Species &RejectionSSAGroup::getSpecies( uint index ) {
+	if( index >= species.size() )
+		species.resize( std::max( (uint)compartment->getChemicalCount(), index + 1 ) );
+	return species[index];
+}
+
+// ---------------------------------------------------------------------------
+void RejectionSSAGroup::watch( uint index ) {
+	if( getSpecies( index ).watchers++ == 0 )
+		compartment->addDependency( index, this );
+}
+
+// ---------------------------------------------------------------------------
+void RejectionSSAGroup::unwatch( uint index ) {
+	if( --species[index].watchers == 0 )
+		compartment->removeDependency( index, this );
+}
+
+} // namespace sgns2
@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2011, Jason Lloyd-Price, Abhishekh Gupta, and Andre S. Ribeiro
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of the contributors may not be used to endorse or promote
+	  products derived from this software without specific prior written
+	  permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* rejectionssa.h/cpp
+
+RejectionSSAGroup class contents:
+	- ReactionGroup implementing the rejection-based SSA (Thanh, Priami and
+	  Zunino, 2014)
+	- Keeps an interval around the population of each species and bounds on
+	  the propensity of each member over the intervals of its reactants
+	- Picks a member in proportion to its upper bound from a sum tree, and
+	  accepts it with probability a / upper, which needs the exact
+	  propensity only if a uniform draw falls between the two bounds
+	- Depends on species rather than on reactions. A population change which
+	  stays within its interval costs a single comparison; the bounds of the
+	  members are only recalculated when one of their species leaves its
+	  interval.
+	- Members whose propensity is not a product of the reactants' rate
+	  functions (e.g. Lua h-functions) cannot be bounded, and are recalculated
+	  exactly on every change of their reactants, as in the other engines
+*/
+
+#ifndef REJECTIONSSA_H
+#define REJECTIONSSA_H
+
+#include <vector>
+
+#include "reactiongroup.h"
+
+namespace sgns2 {
+
+// ===========================================================================
+class RejectionSSAGroup : public ReactionGroup {
+public:
+	explicit RejectionSSAGroup( Compartment *in ) throw();
+	virtual ~RejectionSSAGroup() throw();
+
+	// Manage the relative half-width of the population intervals
+	// Only affects intervals which are not yet set
+	static inline double getDelta() throw() { return delta; }
+	static inline void setDelta( double d ) throw() { delta = d; }
+
+	// ReactionGroup interface
+	virtual GroupMember *newMember( const reaction::Template *tmplate );
+	virtual void removeMember( GroupMember *member ) throw();
+	virtual void touch( GroupMember *member ) throw();
+
+	// Tries one of the members, firing it if it is accepted
+	virtual void trigger() throw();
+	// A species that the group depends on changed
+	virtual void popUpdate( uint species ) throw();
+	// Recalculates the bounds of the members whose species left their
+	// intervals
+	virtual void update() throw();
+
+private:
+	// The slot of a Member is its leaf in the sum tree
+	class Member : public GroupMember {
+	public:
+		Member( RejectionSSAGroup *group, const reaction::Template *tmplate ) throw()
+			: GroupMember( group, tmplate ), c(tmplate->getC()), lower(0.0), upper(0.0)
+			, exact(!tmplate->hasDefaultHEvaluator()), touched(false) { }
+		virtual ~Member() throw() {
+			getGroup()->removeMember( this );
+		}
+
+		double c; // The reaction's stochastic constant at instantiation
+		double lower, upper; // Bounds on the member's propensity
+		bool exact; // Are the bounds the exact propensity? (not boundable)
+		bool touched; // Set while the member is on the touched list
+	};
+	struct Species {
+		Species() : lower(1), upper(0), watchers(0), changed(false) { }
+		std::vector<Member*> readers; // Bounded members reading the species
+		Population lower, upper; // The population interval (empty if unset)
+		uint watchers; // Number of members reading the species
+		bool changed; // Set while the species is on the changed list
+	};
+
+	// Smallest half-width of an interval
+	static const int MIN_HALF_WIDTH = 1;
+
+	// Get the species, growing the table if necessary
+	Species &getSpecies( uint index );
+	// Depend on a species
+	void watch( uint index );
+	void unwatch( uint index );
+	// Sets a new interval around the population of a species, and touches
+	// the members reading it
+	void recenter( uint index ) throw();
+	// Calculates the bounds on the propensity of a member
+	void calcBounds( Member *m ) throw();
+	// Recalculates everything that has changed since the last flush
+	void flush() throw();
+	// Sets the upper bound of a slot in the sum tree
+	void setUpper( uint slot, double a ) throw();
+
+	// Relative half-width of the population intervals
+	static double delta;
+
+	std::vector<Member*> members;
+	std::vector<Species> species; // By species index in the compartment
+	std::vector<uint> changedSpecies;
+	std::vector<Member*> touchedList;
+	// Sum tree over the upper bounds. The bound of slot i is at
+	// tree[treeCapacity + i], and each node is the sum of its two children.
+	std::vector<double> tree;
+	uint treeCapacity;
+};
+
+} // namespace sgns2
+
+#endif // REJECTIONSSA_H
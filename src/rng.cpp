@@ -148,9 +148,45 @@ double RNG::RNG::gamma(double shape, double scale)
 
 } // RNG::RNG::gamma
 
-// NB. !!! Big fat warning !!!
-	// The code below is likely to possess race conditions.
-	// Since I don't use it, you can fix it yourself. -A
+// __________________________________________________________________________
+// Generate n gamma variates with parameters 'shape' and 'scale'
+
+void RNG::RNG::gamma(double* res, uint n, double shape, double scale)
+{
+  if (shape < 1.) {
+    gamma(res, n, shape + 1., scale);
+    const double e = 1.0 / shape;
+    for (uint i = 0; i < n; i++)
+      res[i] *= pow(rand_open01(), e);
+    return;
+  }
+
+  const double d = shape - 1. / 3.;
+  const double c = 1. / sqrt(9. * d);
+  const double ds = d * scale;
+  for (uint i = 0; i < n; i++) {
+    double x, v;
+    for (;;) {
+      do {
+        x = RNOR();
+        v = 1.0 + c * x;
+      } while (v <= 0.0);
+      v = v * v * v;
+      const double u = rand_open01();
+      const double x2 = x * x;
+      if (u < 1.0 - 0.0331 * x2 * x2)
+        break;
+      if (log(u) < 0.5 * x2 + d * (1.0 - v + log(v)))
+        break;
+    }
+    res[i] = ds * v;
+  }
+
+} // RNG::RNG::gamma
+
+// The set-up that poisson() and binomial() reuse between calls with the same
+// parameters used to be static, which raced between threads. It now lives in
+// the RNG object (poissonCache and binomialCache).
 
 // __________________________________________________________________________
 // Generate a Poisson variate 
@@ -167,12 +203,16 @@ int RNG::RNG::poisson(double mu)
   const double fact[10] =
     { 1., 1., 2., 6., 24., 120., 720., 5040., 40320., 362880.  };
 
-  static int l, m;
+  int &l = poissonCache.l, &m = poissonCache.m;
 
-  static double b1, b2, c, c0, c1, c2, c3;
-  static double pp[36], p0, p, q, s, d, omega;
-  static double big_l;/* integer "w/o overflow" */
-  static double muprev = 0., muprev2 = 0.;/*, muold     = 0.*/
+  double &b1 = poissonCache.b1, &b2 = poissonCache.b2, &c = poissonCache.c,
+    &c0 = poissonCache.c0, &c1 = poissonCache.c1, &c2 = poissonCache.c2,
+    &c3 = poissonCache.c3;
+  double *pp = poissonCache.pp, &p0 = poissonCache.p0, &p = poissonCache.p,
+    &q = poissonCache.q, &s = poissonCache.s, &d = poissonCache.d,
+    &omega = poissonCache.omega;
+  double &big_l = poissonCache.big_l;/* integer "w/o overflow" */
+  double &muprev = poissonCache.muprev, &muprev2 = poissonCache.muprev2;
 
   double del, difmuk= 0., E= 0., fk= 0., fx, fy, g, px, py, t, u= 0., v, x;
   int pois = -1;
@@ -309,10 +349,14 @@ Step_F:
 
 int RNG::RNG::binomial(double pp, int n)
 {
-  static double c, fm, npq, p1, p2, p3, p4, qn, xl, xll, xlr, xm, xr;
-
-  static double psave = -1.0;
-  static int nsave = -1, m = 0;
+  double &c = binomialCache.c, &fm = binomialCache.fm, &npq = binomialCache.npq,
+    &p1 = binomialCache.p1, &p2 = binomialCache.p2, &p3 = binomialCache.p3,
+    &p4 = binomialCache.p4, &qn = binomialCache.qn, &xl = binomialCache.xl,
+    &xll = binomialCache.xll, &xlr = binomialCache.xlr, &xm = binomialCache.xm,
+    &xr = binomialCache.xr;
+
+  double &psave = binomialCache.psave;
+  int &nsave = binomialCache.nsave, &m = binomialCache.m;
 
   double f, x;
 
@@ -94,13 +94,34 @@ class RNG
 private:
 	MTRand mtr;
 
+	// Set-up of the last parameters used by poisson() and binomial(). Kept in
+	// each generator, so that generators in different threads are independent.
+	struct PoissonCache {
+		int l, m;
+		double b1, b2, c, c0, c1, c2, c3;
+		double pp[36], p0, p, q, s, d, omega;
+		double big_l;
+		double muprev, muprev2;
+	} poissonCache;
+	struct BinomialCache {
+		double c, fm, npq, p1, p2, p3, p4, qn, xl, xll, xlr, xm, xr;
+		double psave;
+		int nsave, m;
+	} binomialCache;
+	void resetCaches() {
+		poissonCache.muprev = poissonCache.muprev2 = 0.;
+		binomialCache.psave = -1.0;
+		binomialCache.nsave = -1;
+		binomialCache.m = 0;
+	}
+
 	static ulong kn[128], ke[256];
 	static double wn[128], fn[128], we[256],fe[256];
 
 public:
-	RNG() { zigset(); }
-	RNG(ulong x_) : mtr(x_) { zigset(); }
-	RNG(ulong z_, ulong, ulong, ulong ) : mtr(z_) { zigset(); }
+	RNG() { zigset(); resetCaches(); }
+	RNG(ulong x_) : mtr(x_) { zigset(); resetCaches(); }
+	RNG(ulong z_, ulong, ulong, ulong ) : mtr(z_) { zigset(); resetCaches(); }
 	~RNG() { }
 
 	// 32 bit unsigned longs
@@ -174,6 +195,8 @@ public:
 		for (std::vector<double>::iterator i = res.begin(); i != res.end(); ++i)
 			*i = gamma(shape, scale);
 	}
+	// n variates at once, setting the method up once for all of them
+	void gamma(double* res, uint n, double shape = 1, double scale = 1);
 	void chi_square(std::vector<double>& res, double df) {
 		for (std::vector<double>::iterator i = res.begin(); i != res.end(); ++i)
 			*i = chi_square(df);
@@ -48,13 +48,21 @@ namespace sgns2 {
 #else
 #define SGNS_FASTCALL
 #endif
+#define SGNS_THREADLOCAL __declspec( thread )
 #else
 #define SGNS_NOVTABLE
 #define SGNS_FASTCALL
+#define SGNS_THREADLOCAL __thread
 #endif
 
 typedef uint_fast32_t uint;
 typedef int_fast64_t Population;
+#ifdef SGNS_COMPACT_POPULATIONS
+// Populations as compartments store them until they outgrow 32 bits. A
+// compartment then switches to 64-bit Populations for good (see
+// Compartment::setPopulationNoUpdate), so values are never truncated.
+typedef int32_t CompactPopulation;
+#endif
 typedef uint32_t uint32;
 typedef uint16_t uint16;
 typedef uint64_t uint64;
@@ -46,8 +46,7 @@ EventStream *SimulationInstance::runStep() throw() {
 
 // ---------------------------------------------------------------------------
 void SimulationInstance::update() throw() {
-	while( !toUpdate.empty() )
-		toUpdate.pop_front<EventStream*>()->update();
+	toUpdate.updateAll();
 }
 
 // ---------------------------------------------------------------------------
@@ -75,7 +74,7 @@ bool SimulationInstance::internalStep() throw() {
 			// Selection
 			lastEvent = getSimEventQueue()->getNextEvent();
 			// Execution
-			lastEvent->trigger();
+			dispatchTrigger( lastEvent );
 			// Update
 			update();
 			return true;
@@ -85,7 +84,7 @@ bool SimulationInstance::internalStep() throw() {
 		getParallelQueue()->setBaseTime( parTime );
 		getSimEventQueue()->setBaseTime( parTime );
 		lastEvent = getParallelQueue()->getNextEvent();
-		lastEvent->trigger();
+		dispatchTrigger( lastEvent );
 		// Update
 		update();
 		return true;
@@ -73,7 +73,7 @@ public:
 	inline EventStream *getLastEvent() { return lastEvent; }
 	// Returns the update list (the list of EventStreams that must be update()d
 	// before the next simulation step
-	inline SimpleSLL *getUpdateList() { return &toUpdate; }
+	inline UpdateList *getUpdateList() { return &toUpdate; }
 	// Sets the current simulation time
 	inline void setTime( double time ) throw() { simQueue.setBaseTime( time ); }
 	// Access to the current simulation time
@@ -112,7 +112,7 @@ private:
 	// The last event that occurred
 	EventStream *lastEvent;
 	// The Update list
-	SimpleSLL toUpdate;
+	UpdateList toUpdate;
 	// The main simulation queue
 	EventStreamQueue simQueue;
 	// The parallel simulation queue (for sampling events, etc..)
@@ -14,10 +14,19 @@ extern "C" {
 }
 
 #include "simulationloader.h"
+#include "hybrid.h"
+#include "luaexpression.h"
+#include "modelcompiler.h"
+#include "reactiongroup.h"
+#include "rejectionssa.h"
 #include "sbmlreader.h"
+#include "tauleap.h"
+#include "waitlist.h"
 
 using namespace sgns2;
 
+const double SimulationLoader::QE_SEPARATION = 100.0;
+
 // ---------------------------------------------------------------------------
 SimulationLoader::SimulationLoader()
 : parser(NULL)
@@ -40,6 +49,9 @@ SimulationLoader::SimulationLoader()
 , outputTarget(OUTPUTTGT_FILE)
 , chemicalCount(0), reactionCount(0)
 , maxSplitCount(0)
+, engine(reaction::Template::ENGINE_NRM), engineReactionCount(0)
+, qeAuto(false)
+, rateTableSize(0), delaySlotCount(0)
 , L_packed(NULL)
 {
 	show[SHOW_PROGRESS] = false;
@@ -71,6 +83,12 @@ SimulationLoader::~SimulationLoader() {
 		delete it->second.type; // destroys all reactions too
 	for( ChemicalMap::iterator it = chemicals.begin(); it != chemicals.end(); ++it )
 		delete it->second;
+	for( size_t i = 0; i < luaExpressions.size(); i++ )
+		delete luaExpressions[i];
+	for( size_t i = 0; i < rateTables.size(); i++ )
+		delete rateTables[i];
+	for( size_t i = 0; i < dimerTables.size(); i++ )
+		delete dimerTables[i];
 
 	//for( InitCmdList::iterator it = initCommands.begin(); it != initCommands.end(); ++it )
 	//	delete *it;
@@ -80,6 +98,45 @@ SimulationLoader::~SimulationLoader() {
 // ---------------------------------------------------------------------------
 bool SimulationLoader::parseExtra( const char *id, const char *data ) {
 	switch( id[0] ) {
+	case 'c':
+		if( 0 == strcmp( id, "compile_model" ) ) {
+			if( !*data )
+				parser->raiseError( "Expected a directory for the compiled model" );
+			modelCache = data;
+			return true;
+		}
+		break;
+	case 'e':
+		if( 0 == strcmp( id, "event_dispatch" ) ) {
+			if( 0 == strcmp( data, "tagged" ) )
+				EventStream::setTaggedDispatch( true );
+			else if( 0 == strcmp( data, "virtual" ) )
+				EventStream::setTaggedDispatch( false );
+			else
+				parser->raiseError( "Unknown event dispatch '%s'. Expected: tagged or virtual", data );
+			return true;
+		} else if( 0 == strcmp( id, "event_queue" ) ) {
+			EventQueue::Backend backend;
+			if( !EventQueue::findBackend( data, backend ) )
+				parser->raiseError( "Unknown event queue '%s'. Expected: binary, 4ary, soa or tournament", data );
+			EventQueue::setDefaultBackend( backend );
+			return true;
+		} else if( 0 == strcmp( id, "engine" ) ) {
+			if( !ReactionGroup::findEngine( data, engine ) )
+				parser->raiseError( "Unknown engine '%s'. Expected: nrm, cr, pdm, tau, hybrid or rssa", data );
+			return true;
+		}
+		break;
+	case 'h':
+		if( 0 == strcmp( id, "hybrid_threshold" ) ) {
+			char *end;
+			double copies = strtod( data, &end );
+			if( end == data || *end || copies < 0.0 )
+				parser->raiseError( "Expected a non-negative number of copies" );
+			HybridGroup::setThreshold( copies );
+			return true;
+		}
+		break;
 	case 'i':
 		if( 0 == strcmp( id, "import" ) ) {
 			char format[32];
@@ -193,6 +250,57 @@ bool SimulationLoader::parseExtra( const char *id, const char *data ) {
 			} else {
 				parser->raiseError( "Expected: 'on' or 'off'" );
 			}
+			RateTable::setCounting( show[SHOW_PERFORMANCE] );
+			return true;
+		}
+		break;
+	case 'q':
+		if( 0 == strcmp( id, "quasi_equilibrium" ) ) {
+			if( 0 == strcmp( data, "auto" ) ) {
+				qeAuto = true;
+				return true;
+			}
+			char forward[64], reverse[64], trailing;
+			if( 2 != sscanf( data, "%63s %63s %c", forward, reverse, &trailing ) )
+				parser->raiseError( "Expected 'auto' or the names of a forward and a reverse reaction" );
+			qePairs.push_back( std::make_pair( std::string( forward ), std::string( reverse ) ) );
+			return true;
+		}
+		break;
+	case 'r':
+		if( 0 == strcmp( id, "rate_table" ) ) {
+			char *end;
+			unsigned long size = strtoul( data, &end, 10 );
+			if( end == data || *end || size > (1ul << 24) )
+				parser->raiseError( "Expected a number of populations to tabulate, up to 16777216" );
+			rateTableSize = (uint)size;
+			return true;
+		} else if( 0 == strcmp( id, "rssa_delta" ) ) {
+			char *end;
+			double d = strtod( data, &end );
+			if( end == data || *end || !(d > 0.0 && d < 1.0) )
+				parser->raiseError( "Expected a relative interval half-width between 0 and 1" );
+			RejectionSSAGroup::setDelta( d );
+			return true;
+		}
+		break;
+	case 't':
+		if( 0 == strcmp( id, "tau_epsilon" ) ) {
+			char *end;
+			double eps = strtod( data, &end );
+			if( end == data || *end || !(eps > 0.0 && eps < 1.0) )
+				parser->raiseError( "Expected a tau-leaping error bound between 0 and 1" );
+			TauLeapGroup::setEpsilon( eps );
+			return true;
+		}
+		break;
+	case 'w':
+		if( 0 == strcmp( id, "waitlist_epsilon" ) ) {
+			char *end;
+			double eps = strtod( data, &end );
+			if( end == data || *end || eps < 0.0 )
+				parser->raiseError( "Expected a non-negative bin width" );
+			WaitList::setBinWidth( eps );
 			return true;
 		}
 		break;
@@ -389,8 +497,11 @@ void SimulationLoader::finishReaction( double c ) {
 			rxnIndex = reactsIn[i]->getBank()->createReaction( umbrellaBank, umbrellaIndex, i+1 < typeUsed.size(), rxnDestroysCompartment && i >= rxnDestroysCompartment );
 			reaction::Template *tmplate = reactsIn[i]->getBank()->getReactionTemplate( rxnIndex );
 			tmplate->setC( c );
-			if( rxnHEval && reactantHead->compartment == i )
+			bool luaH = false;
+			if( rxnHEval && reactantHead->compartment == i ) {
 				tmplate->setHEvaluator( rxnHEval );
+				luaH = rxnHEval == &hEval_lua;
+			}
 			
 			TempChemical **prevR = &reactantHead;
 			if( reactantsInExtra ) {
@@ -428,6 +539,8 @@ void SimulationLoader::finishReaction( double c ) {
 					if( r->compartment == i ) {
 						reaction::Product *prod = tmplate->newProduct( r->chemicalIdx, r->n, 0 );
 						*prod->getTau() = r->tau;
+						if( !r->tau.isConstant() )
+							prod->setDelaySlot( delaySlotCount++ );
 
 						TempChemical *next = r->next;
 						*prevR = r->next;
@@ -441,6 +554,8 @@ void SimulationLoader::finishReaction( double c ) {
 			}
 
 			tmplate->flipChemicalOrders();
+			if( luaH )
+				compileLuaH( tmplate );
 			bottomTemplate = tmplate;
 			umbrellaIndex = rxnIndex;
 			umbrellaBank = i;
@@ -526,6 +641,15 @@ void SimulationLoader::finishReaction( double c ) {
 	if( extraCommands )
 		bottomTemplate->addExtra( extraCommands );
 
+	if( rxnHasName ) {
+		// Remember the reaction for quasi_equilibrium annotations. Only
+		// single-template reactions can be folded, so the bottom one will do.
+		NamedReaction named;
+		named.type = reactsIn[umbrellaBank];
+		named.index = umbrellaIndex;
+		namedReactions.insert( NamedReactionMap::value_type( rxnName, named ) );
+	}
+
 	reactionCount++;
 
 	uint rxnSplitCount = rxnCompSplitCount + static_cast<uint>(splits.size());
@@ -969,9 +1093,24 @@ void SimulationLoader::loadingComplete() {
 		}
 	}
 
-	// Seal all reaction banks
+	foldQuasiEquilibria();
+	if( rateTableSize )
+		tabulateRates();
+
+	// Compile all reaction banks, natively too if asked to
 	for( CompTypeMap::iterator it = compTypes.begin(); it != compTypes.end(); ++it )
+		(*it).second.type->getBank()->compile();
+	if( !modelCache.empty() )
+		compileModel();
+
+	// Seal all reaction banks and hand what reactions we can to the engine
+	engineReactionCount = 0;
+	for( CompTypeMap::iterator it = compTypes.begin(); it != compTypes.end(); ++it ) {
 		(*it).second.type->getBank()->seal();
+		if( engine != reaction::Template::ENGINE_NRM )
+			engineReactionCount += (*it).second.type->getBank()->selectEngine( engine );
+		(*it).second.type->getBank()->layOutInstances();
+	}
 
 	// Clear intermediate reaction memory
 	resetReaction();
@@ -1126,6 +1265,129 @@ SimulationLoader::InitCmdExtra::~InitCmdExtra() {
 		delete *it;
 }
 
+// ---------------------------------------------------------------------------
+void SimulationLoader::foldQuasiEquilibria() {
+	for( size_t i = 0; i < qePairs.size(); i++ ) {
+		NamedReactionMap::const_iterator fwd = namedReactions.find( qePairs[i].first );
+		NamedReactionMap::const_iterator rev = namedReactions.find( qePairs[i].second );
+		if( fwd == namedReactions.end() || rev == namedReactions.end() ) {
+			std::cerr << "Warning: Unknown reaction '" << (fwd == namedReactions.end() ? qePairs[i].first : qePairs[i].second) << "' in quasi_equilibrium" << std::endl;
+		} else if( fwd->second.type == rev->second.type && fwd->second.type->getBank()->canFoldPair( fwd->second.index, rev->second.index ) ) {
+			foldPair( fwd->second.type, fwd->second.index, rev->second.index );
+		} else if( fwd->second.type == rev->second.type && fwd->second.type->getBank()->canFoldPair( rev->second.index, fwd->second.index ) ) {
+			// Dissociation given first
+			foldPair( fwd->second.type, rev->second.index, fwd->second.index );
+		} else {
+			std::cerr << "Warning: Reactions '" << qePairs[i].first << "' and '" << qePairs[i].second << "' cannot be simulated in quasi-equilibrium" << std::endl;
+		}
+	}
+
+	if( qeAuto ) {
+		for( CompTypeMap::iterator it = compTypes.begin(); it != compTypes.end(); ++it ) {
+			uint forward, reverse;
+			while( (*it).second.type->getBank()->findFastPair( forward, reverse, QE_SEPARATION ) )
+				foldPair( (*it).second.type, forward, reverse );
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+void SimulationLoader::foldPair( CompartmentType *type, uint forward, uint reverse ) {
+	reaction::IntraBankTemplate *bank = type->getBank();
+	QuasiEquilibrium::Pair *pair = new QuasiEquilibrium::Pair;
+	QuasiEquilibrium::describePair( bank->getReactionTemplate( forward ), bank->getReactionTemplate( reverse ), *pair );
+
+	// The totals are never output, and their names cannot clash with a
+	// species'. For X -> C the total is X+C, for 2 A -> C it is A+2C.
+	const std::string &bound = type->getChemicalAtIndex( pair->bound )->getName();
+	for( uint i = 0; i < pair->sides; i++ ) {
+		std::string name = type->getChemicalAtIndex( pair->species[i] )->getName() + "+" +
+			(pair->stoich[i] > 1 ? "2" : "") + bound;
+		Chemical *total;
+		ChemicalMap::const_iterator it = chemicals.find( name.c_str() );
+		if( it != chemicals.end() ) {
+			total = it->second;
+		} else {
+			total = new Chemical( name.c_str() );
+			total->setOutput( false );
+			chemicals[total->getName().c_str()] = total;
+		}
+		pair->totals[i] = type->getChemicalIndex( total, true );
+	}
+	bank->foldPair( forward, reverse, pair );
+}
+
+// ---------------------------------------------------------------------------
+void SimulationLoader::tabulateRates() {
+	uint dimerSize = rateTableSize < MAX_DIMER_TABLE_SIZE ? rateTableSize : (uint)MAX_DIMER_TABLE_SIZE;
+
+	for( CompTypeMap::iterator it = compTypes.begin(); it != compTypes.end(); ++it ) {
+		reaction::IntraBankTemplate *bank = (*it).second.type->getBank();
+		for( uint i = 0; i < bank->getReactionCount(); i++ ) {
+			reaction::Template *tmplate = bank->getReactionTemplate( i );
+			reaction::Reactant *r = tmplate->getFirstReactant();
+			if( tmplate->getHEvaluator() == &hEval_sshdimer ) {
+				// Tabulate the dimer term. The reactants after the first
+				// two are evaluated as usual.
+				double k = r->getRateFunction()->p2.d;
+				DimerTable *table = new DimerTable;
+				table->size = dimerSize;
+				table->values.resize( dimerSize * dimerSize );
+				for( uint x1 = 0; x1 < dimerSize; x1++ ) {
+					for( uint x2 = 0; x2 < dimerSize; x2++ )
+						table->values[x1 * dimerSize + x2] = sshdimer( k, (double)x1, (double)x2 );
+				}
+				dimerTables.push_back( table );
+				r->getRateFunction()->p1.p = table;
+				tmplate->setHEvaluator( &hEval_sshdimerTable );
+				r = r->getNext()->getNext();
+			} else if( !tmplate->hasDefaultHEvaluator() ) {
+				// The other special H-functions co-opt the rate functions
+				continue;
+			}
+
+			for( ; r; r = r->getNext() ) {
+				RateFunction *f = r->getRateFunction();
+				if( !BasicRateFunction::isTabulable( f ) )
+					continue;
+				RateTable *table = NULL;
+				for( size_t j = 0; j < rateTables.size() && !table; j++ ) {
+					if( BasicRateFunction::isSameTabulable( f, rateTables[j]->getFunction() ) )
+						table = rateTables[j];
+				}
+				if( !table ) {
+					table = new RateTable( *f, rateTableSize );
+					rateTables.push_back( table );
+				}
+				*f = BasicRateFunction::Tabled( table );
+			}
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+void SimulationLoader::compileModel() {
+	ModelCompiler compiler( modelCache );
+	uint skipped = 0;
+	for( CompTypeMap::iterator it = compTypes.begin(); it != compTypes.end(); ++it ) {
+		reaction::IntraBankTemplate *bank = (*it).second.type->getBank();
+		for( uint i = 0; i < bank->getReactionCount(); i++ ) {
+			if( !compiler.add( bank->getReactionTemplate( i ) ) )
+				skipped++;
+		}
+	}
+	if( compiler.getReactionCount() == 0 )
+		return;
+
+	std::string error;
+	if( !compiler.build( error ) ) {
+		std::cerr << "Warning: Could not compile the model, simulating it without native code: " << error << std::endl;
+	} else if( show[SHOW_PERFORMANCE] ) {
+		std::cerr << "Compiled " << compiler.getReactionCount() << " of " << compiler.getReactionCount() + skipped
+			<< " H-functions natively" << (compiler.wasCached() ? " (cached)" : "") << std::endl;
+	}
+}
+
 // ---------------------------------------------------------------------------
 void SimulationLoader::InitCmdExtra::execute( const reaction::Template *tmplate, Compartment **context ) {
 	(void)tmplate;
@@ -1163,18 +1425,46 @@ double SGNS_FASTCALL SimulationLoader::hEval_fa2a1r( Compartment **context, reac
 	return h;
 }
 
+// ---------------------------------------------------------------------------
+double SimulationLoader::sshdimer( double k, double x1, double x2 ) {
+	// 0.5*   k*(1+(x1+x2)/k-((1+(x1+x2)/k)^2-4*x1*x2/k^2)^0.5)
+	double x1x2_k = 1+(x1+x2)/k;
+	return k * (1 + (x1+x2)/k - sqrt(x1x2_k*x1x2_k - 4*x1*x2/(k*k)));
+}
+
 // ---------------------------------------------------------------------------
 double SGNS_FASTCALL SimulationLoader::hEval_sshdimer( Compartment **context, reaction::Reactant *r ) {
 	// Steady state heterodimer
 
-	// 0.5*   k*(1+(x1+x2)/k-((1+(x1+x2)/k)^2-4*x1*x2/k^2)^0.5)
 	double k = r->getRateFunction()->p2.d;
 	double x1 = (double)r->getPopulationIn( context );
 	r = r->getNext();
 	double x2 = (double)r->getPopulationIn( context );
 	r = r->getNext();
-	double x1x2_k = 1+(x1+x2)/k;
-	double h = k * (1 + (x1+x2)/k - sqrt(x1x2_k*x1x2_k - 4*x1*x2/(k*k)));
+	double h = sshdimer( k, x1, x2 );
+	for( ; r; r = r->getNext() )
+		h *= r->evaluate( context );
+	return h;
+}
+
+// ---------------------------------------------------------------------------
+double SGNS_FASTCALL SimulationLoader::hEval_sshdimerTable( Compartment **context, reaction::Reactant *r ) {
+	// Steady state heterodimer, looked up for small populations
+
+	const DimerTable *table = static_cast<const DimerTable*>(r->getRateFunction()->p1.p);
+	double k = r->getRateFunction()->p2.d;
+	Population x1 = r->getPopulationIn( context );
+	r = r->getNext();
+	Population x2 = r->getPopulationIn( context );
+	r = r->getNext();
+	double h;
+	if( (uint64)x1 < table->size && (uint64)x2 < table->size ) {
+		RateTable::countHit();
+		h = table->values[(size_t)(x1 * table->size + x2)];
+	} else {
+		RateTable::countMiss();
+		h = sshdimer( k, (double)x1, (double)x2 );
+	}
 	for( ; r; r = r->getNext() )
 		h *= r->evaluate( context );
 	return h;
@@ -1192,12 +1482,45 @@ double SGNS_FASTCALL SimulationLoader::hEval_lua( Compartment **context, reactio
 		n++;
 	}
 
-	if( lua_pcall( L, n, 1, 0 ) || !lua_isnumber( L, 1 ) ) {
+	if( lua_pcall( L, n, 1, 0 ) || !lua_isnumber( L, -1 ) ) {
 		lua_pop( L, 1 );
 		return 1.0;
 	}
 
-	double h = (double)lua_tonumber( L, 1 );
+	double h = (double)lua_tonumber( L, -1 );
 	lua_pop( L, 1 );
 	return h;
 }
+
+// ---------------------------------------------------------------------------
+double SGNS_FASTCALL SimulationLoader::hEval_luaExpression( Compartment **context, reaction::Reactant *reactants ) {
+	// Lua h-function translated by LuaExpression, which never touches the
+	// lua_State
+
+	const LuaExpression *e = static_cast<const LuaExpression*>(reactants->getRateFunction()->p1.p);
+	double args[LuaExpression::MAX_ARGS];
+	uint n = e->getArgCount();
+	reaction::Reactant *r = reactants;
+	for( uint i = 0; i < n; i++, r = r->getNext() )
+		args[i] = (double)r->getPopulationIn( context );
+	return e->evaluate( args );
+}
+
+// ---------------------------------------------------------------------------
+void SimulationLoader::compileLuaH( reaction::Template *tmplate ) {
+	reaction::Reactant *first = tmplate->getFirstReactant();
+	uint n = 0;
+	for( reaction::Reactant *r = first; r; r = r->getNext() )
+		n++;
+
+	// Functions which are not pure arithmetic stay in Lua
+	lua_State *L = parser->getL();
+	lua_rawgeti( L, LUA_REGISTRYINDEX, first->getRateFunction()->p0.i );
+	LuaExpression *e = LuaExpression::compile( L, n );
+	lua_pop( L, 1 );
+	if( e ) {
+		luaExpressions.push_back( e );
+		first->getRateFunction()->p1.p = e;
+		tmplate->setHEvaluator( &hEval_luaExpression );
+	}
+}
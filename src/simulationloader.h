@@ -47,6 +47,8 @@ SimulationLoader class contents:
 
 namespace sgns2 {
 
+class LuaExpression;
+
 class SimulationLoader : public parse::ParseListener {
 public:
 	SimulationLoader();
@@ -107,6 +109,11 @@ public:
 	// Model stats
 	inline unsigned getReactionCount() const { return reactionCount; }
 	inline unsigned getChemicalCount() const { return chemicalCount; }
+	// Engine stats
+	inline reaction::Template::Engine getEngine() const { return engine; }
+	inline unsigned getEngineReactionCount() const { return engineReactionCount; }
+	// Number of lookup tables standing in for rate and h-functions
+	inline unsigned getRateTableCount() const { return (unsigned)(rateTables.size() + dimerTables.size()); }
 
 	// Output
 	enum Show {
@@ -151,6 +158,17 @@ protected:
 	// Ensure that a compartment type is in the compartment type
 	// stack for the current reaction
 	bool ensureTypeInStack( CompartmentType *type );
+	// Fold the annotated and, if enabled, the detected fast reversible pairs
+	// into quasi-equilibria
+	void foldQuasiEquilibria();
+	// Fold a pair of reactions, adding hidden species for their totals
+	void foldPair( CompartmentType *type, uint forward, uint reverse );
+	// Replace the default H-functions of the reactions with natively
+	// compiled code, where their rate functions allow it
+	void compileModel();
+	// Replace the rate functions which call pow(), and the sshdimer
+	// h-functions, with lookups in tables of rateTableSize populations
+	void tabulateRates();
 
 	// The parser
 	parse::Parser *parser;
@@ -283,6 +301,37 @@ protected:
 	uint reactionCount;
 	uint maxSplitCount;
 
+	// Engine which simulates the reactions that it can (others use the NRM)
+	reaction::Template::Engine engine;
+	uint engineReactionCount;
+
+	// Quasi-equilibrium approximation of fast reversible pairs
+	// Detected pairs must be this many times faster than the other
+	// reactions reading their species
+	static const double QE_SEPARATION;
+	// Detect fast pairs automatically?
+	bool qeAuto;
+	// Pairs annotated by reaction name (forward, reverse)
+	std::vector< std::pair< std::string, std::string > > qePairs;
+	// Reaction Name -> bank and index of the reaction's bottom template
+	struct NamedReaction {
+		CompartmentType *type;
+		uint index;
+	};
+	typedef std::map< std::string, NamedReaction > NamedReactionMap;
+	NamedReactionMap namedReactions;
+
+	// Directory in which natively compiled models are cached, or empty if
+	// the model is not to be compiled
+	std::string modelCache;
+	// Number of populations covered by the rate function tables, or 0 if
+	// the functions are not to be tabulated
+	uint rateTableSize;
+	// The tables, shared by all the rate functions with the same parameters
+	std::vector< RateTable* > rateTables;
+	// Number of delayed products whose delays are drawn in blocks
+	uint delaySlotCount;
+
 	// Lua state backup for batch runs
 	void *L_packed;
 	uint L_packedsize;
@@ -293,7 +342,27 @@ protected:
 	// Special H-functions
 	static double SGNS_FASTCALL hEval_fa2a1r( Compartment **context, reaction::Reactant *firstReactant );
 	static double SGNS_FASTCALL hEval_sshdimer( Compartment **context, reaction::Reactant *firstReactant );
+	// The dimer term of sshdimer, without the other reactants
+	static double sshdimer( double k, double x1, double x2 );
 	static double SGNS_FASTCALL hEval_lua( Compartment **context, reaction::Reactant *firstReactant );
+	static double SGNS_FASTCALL hEval_luaExpression( Compartment **context, reaction::Reactant *firstReactant );
+	// Replaces the reaction's Lua h-function with a LuaExpression if the
+	// function is pure arithmetic
+	void compileLuaH( reaction::Template *tmplate );
+	// The translated Lua h-functions
+	std::vector< LuaExpression* > luaExpressions;
+	// Values of the sshdimer h-function of its first two reactants, for
+	// populations of both below size, indexed by x1 * size + x2
+	struct DimerTable {
+		uint size;
+		std::vector< double > values;
+	};
+	std::vector< DimerTable* > dimerTables;
+	static double SGNS_FASTCALL hEval_sshdimerTable( Compartment **context, reaction::Reactant *firstReactant );
+	enum {
+		// Largest number of populations of each reactant in a DimerTable
+		MAX_DIMER_TABLE_SIZE = 256
+	};
 };
 
 } // namespace sgns2
@@ -117,7 +117,7 @@ void FileRecordSampler<T>::sampleCompartment( sgns2::HierCompartment *compartmen
 			if( !first_column  ) {
 				target->writeData( &recordSeparator[0], recordSepLen );
 			}
-			static_cast<T*>(this)->writeRecord( (sgns2::int64)compartment->getWaitList()->getSize());
+			static_cast<T*>(this)->writeRecord( (sgns2::int64)compartment->getWaitListSize());
 			first_column = false;
 		}
 
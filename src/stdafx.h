@@ -14,12 +14,21 @@ extern "C" {
 #include "chemical.h"
 #include "compartment.h"
 #include "compartmenttype.h"
+#include "compositionrejection.h"
 #include "distribution.h"
 #include "event.h"
 #include "hiercompartment.h"
+#include "hybrid.h"
+#include "luaexpression.h"
+#include "modelcompiler.h"
+#include "partialpropensity.h"
+#include "quasiequilibrium.h"
+#include "tauleap.h"
 #include "rate.h"
 #include "reaction.h"
 #include "reactionbank.h"
+#include "reactiongroup.h"
+#include "rejectionssa.h"
 #include "simtypes.h"
 #include "simulation.h"
 #include "split.h"
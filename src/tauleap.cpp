@@ -0,0 +1,356 @@
+// See tauleap.h for a description of the contents of this file.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "tauleap.h"
+
+namespace sgns2 {
+
+using reaction::Reactant;
+using reaction::Product;
+
+double TauLeapGroup::epsilon = 0.03;
+
+// ---------------------------------------------------------------------------
+static double highestOrderG( int order, int speciesOrder, double x ) {
+	// The factor g_i of Cao, Gillespie and Petzold (2006) for a species with
+	// the given order in a reaction of the given total order. The relative
+	// change of the propensity is at most g_i times that of the population.
+	double g = speciesOrder;
+	for( int k = 1; k < speciesOrder; k++ )
+		g += k / std::max( x - k, 1.0 );
+	return g * order / speciesOrder;
+}
+
+// ---------------------------------------------------------------------------
+TauLeapGroup::Member::Member( TauLeapGroup *group, const reaction::Template *tmplate ) throw()
+: GroupMember( group, tmplate )
+, c(tmplate->getC())
+, a(0.0)
+, order(tmplate->hasDefaultHEvaluator() ? 0 : -1)
+, count(0)
+, critical(false)
+, touched(false)
+{
+	// Delayed products do not change the populations within a leap
+	collectChanges( tmplate, changes );
+	for( Reactant *r = tmplate->getFirstReactant(); r; r = r->getNext() ) {
+		int speciesOrder = BasicRateFunction::getGilHOrder( r->getRateFunction() );
+		if( speciesOrder < 0 )
+			order = -1;
+		else if( order >= 0 )
+			order += speciesOrder;
+	}
+}
+
+// ---------------------------------------------------------------------------
+TauLeapGroup::TauLeapGroup( Compartment *in ) throw()
+: ReactionGroup( in, reaction::Template::ENGINE_TAU )
+, leapStart(0.0)
+, criticalMember(NULL)
+, exactSteps(0)
+, leaping(false)
+{
+}
+
+// ---------------------------------------------------------------------------
+TauLeapGroup::~TauLeapGroup() throw() {
+	assert( members.empty() ); // All members must be destroyed first
+}
+
+// ---------------------------------------------------------------------------
+GroupMember *TauLeapGroup::newMember( const reaction::Template *tmplate ) {
+	// Members depend on their reactants exactly as NRM reactions do
+	Member *member = new Member( this, tmplate );
+	tmplate->addDependencies( &compartment, member );
+	member->setSlot( (uint)members.size() );
+	members.push_back( member );
+	return member;
+}
+
+// ---------------------------------------------------------------------------
+void TauLeapGroup::removeMember( GroupMember *member ) throw() {
+	// Any firings of the member planned for the current leap are lost
+	Member *m = static_cast<Member*>(member);
+	m->getTemplate()->removeDependencies( &compartment, m );
+	Member *last = members.back();
+	last->setSlot( m->getSlot() );
+	members[m->getSlot()] = last;
+	members.pop_back();
+	if( m->touched )
+		touchedList.erase( std::find( touchedList.begin(), touchedList.end(), m ) );
+	if( criticalMember == m )
+		criticalMember = NULL;
+
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void TauLeapGroup::touch( GroupMember *member ) throw() {
+	Member *m = static_cast<Member*>(member);
+	if( !m->touched ) {
+		m->touched = true;
+		touchedList.push_back( m );
+	}
+	scheduleUpdate();
+}
+
+// ---------------------------------------------------------------------------
+void TauLeapGroup::trigger() throw() {
+	double t = getQueue()->getBaseTime();
+	// The members touched by the firings are recalculated by plan()
+	bool wasScheduled = updSelf;
+	updSelf = true;
+
+	if( leaping ) {
+		applyCounts( t );
+		if( criticalMember )
+			criticalMember->getTemplate()->execute( &compartment );
+	} else {
+		Member *m = choose( false, totalA );
+		if( m )
+			m->getTemplate()->execute( &compartment );
+		if( exactSteps > 0 )
+			exactSteps--;
+	}
+
+	plan( t );
+	updSelf = wasScheduled;
+}
+
+// ---------------------------------------------------------------------------
+void TauLeapGroup::update() throw() {
+	// Some population changed in the middle of the leap. Commit the part of
+	// the leap which has elapsed and start over from the new populations.
+
+	double t = getQueue()->getUpdatedBaseTime();
+	updSelf = true;
+
+	if( leaping ) {
+		// Firing counts of a Poisson process over the elapsed fraction of
+		// the leap follow a binomial distribution given the full counts.
+		// The critical firing, if any, was due at the end.
+		double elapsed = std::min( (t - leapStart) / (nextT - leapStart), 1.0 );
+		criticalMember = NULL;
+		if( elapsed > 0.0 ) {
+			RNG::RNG *rng = getRNG();
+			fullCounts.resize( members.size() );
+			for( size_t i = 0; i < members.size(); i++ )
+				fullCounts[i] = members[i]->count;
+
+			// An outside change may have taken away molecules that the
+			// planned firings need. Give up on the elapsed part if thinning
+			// keeps leaving a negative population.
+			bool valid = false;
+			for( int attempt = 0; attempt < THINNING_ATTEMPTS && !valid; attempt++ ) {
+				for( size_t i = 0; i < members.size(); i++ )
+					members[i]->count = fullCounts[i] > 0 ? rng->binomial( elapsed, fullCounts[i] ) : 0;
+				valid = sumChanges();
+			}
+			if( valid )
+				applyCounts( t );
+		}
+	}
+
+	plan( t );
+	updSelf = false;
+}
+
+// ---------------------------------------------------------------------------
+void TauLeapGroup::flushTouched() throw() {
+	for( size_t i = 0; i < touchedList.size(); i++ ) {
+		Member *m = touchedList[i];
+		m->touched = false;
+		m->a = m->c * m->getTemplate()->calcH( &compartment );
+	}
+	touchedList.clear();
+}
+
+// ---------------------------------------------------------------------------
+void TauLeapGroup::plan( double t ) throw() {
+	flushTouched();
+	leaping = false;
+	criticalMember = NULL;
+	for( size_t i = 0; i < members.size(); i++ )
+		members[i]->count = 0;
+
+	double a0 = 0.0;
+	for( size_t i = 0; i < members.size(); i++ )
+		a0 += members[i]->a;
+	if( !(a0 > 0.0) ) {
+		reschedule( t, 0.0, true );
+		return;
+	}
+
+	if( exactSteps == 0 ) {
+		// Leaps that are expected to fire fewer than a few reactions cost more
+		// than they save over exact steps
+		double leapTau = selectLeap();
+		if( leapTau >= MIN_LEAP_STEPS / a0 && leapTau < std::numeric_limits<double>::infinity() ) {
+			RNG::RNG *rng = getRNG();
+			double criticalA = 0.0;
+			for( size_t i = 0; i < members.size(); i++ ) {
+				if( members[i]->critical )
+					criticalA += members[i]->a;
+			}
+
+			double tau;
+			for( ;; ) {
+				// The next critical firing happens at the end of the leap if
+				// it comes before the leap is over
+				double criticalTau = criticalA > 0.0 ? rng->exponential( criticalA ) : std::numeric_limits<double>::infinity();
+				tau = std::min( leapTau, criticalTau );
+				criticalMember = criticalTau <= leapTau ? choose( true, criticalA ) : NULL;
+				for( size_t i = 0; i < members.size(); i++ ) {
+					Member *m = members[i];
+					m->count = !m->critical && m->a > 0.0 ? rng->poisson( m->a * tau ) : 0;
+				}
+				if( sumChanges() )
+					break;
+				// Some population went negative; try again with a shorter leap
+				leapTau *= 0.5;
+			}
+
+			leaping = true;
+			leapStart = t;
+			totalA = a0;
+			nextT = t + tau;
+			schedule( nextT );
+			return;
+		}
+		exactSteps = EXACT_STEPS;
+	}
+
+	reschedule( t, a0, true );
+}
+
+// ---------------------------------------------------------------------------
+double TauLeapGroup::selectLeap() throw() {
+	// Step 2 and 3 of Cao, Gillespie and Petzold (2006): sort out the
+	// critical members, then bound the expected change and standard
+	// deviation of each reactant species of the others by epsilon x_i / g_i
+
+	uint n = compartment->getChemicalCount();
+	mu.assign( n, 0.0 );
+	sigma2.assign( n, 0.0 );
+	g.assign( n, 0.0 );
+
+	for( size_t i = 0; i < members.size(); i++ ) {
+		Member *m = members[i];
+		// Propensities which are not mass-action cannot be bounded
+		m->critical = m->order < 0;
+		if( m->a <= 0.0 || m->critical )
+			continue;
+		for( size_t j = 0; j < m->changes.size() && !m->critical; j++ ) {
+			const Change &ch = m->changes[j];
+			if( ch.amount < 0 && compartment->getPopulation( ch.species ) < (Population)CRITICAL_FIRINGS * -ch.amount )
+				m->critical = true;
+		}
+		if( m->critical )
+			continue;
+
+		for( size_t j = 0; j < m->changes.size(); j++ ) {
+			const Change &ch = m->changes[j];
+			mu[ch.species] += ch.amount * m->a;
+			sigma2[ch.species] += (double)ch.amount * ch.amount * m->a;
+		}
+		for( Reactant *r = m->getTemplate()->getFirstReactant(); r; r = r->getNext() ) {
+			int speciesOrder = BasicRateFunction::getGilHOrder( r->getRateFunction() );
+			if( speciesOrder <= 0 )
+				continue;
+			uint s = r->getIndex();
+			g[s] = std::max( g[s], highestOrderG( m->order, speciesOrder, (double)compartment->getPopulation( s ) ) );
+		}
+	}
+
+	double tau = std::numeric_limits<double>::infinity();
+	for( int pass = 0; pass < 2 && !(tau < std::numeric_limits<double>::infinity()); pass++ ) {
+		// If no reactant species bounds the leap (all the non-critical
+		// members are zeroth-order, say), bound every species that changes
+		for( uint s = 0; s < n; s++ ) {
+			if( pass == 0 ? g[s] <= 0.0 : sigma2[s] <= 0.0 )
+				continue;
+			double bound = std::max( epsilon * (double)compartment->getPopulation( s ) / std::max( g[s], 1.0 ), 1.0 );
+			if( mu[s] != 0.0 )
+				tau = std::min( tau, bound / std::fabs( mu[s] ) );
+			if( sigma2[s] > 0.0 )
+				tau = std::min( tau, bound * bound / sigma2[s] );
+		}
+	}
+	return tau;
+}
+
+// ---------------------------------------------------------------------------
+bool TauLeapGroup::sumChanges() throw() {
+	uint n = compartment->getChemicalCount();
+	delta.assign( n, 0 );
+	for( size_t i = 0; i < members.size(); i++ ) {
+		Member *m = members[i];
+		if( m->count == 0 )
+			continue;
+		for( size_t j = 0; j < m->changes.size(); j++ )
+			delta[m->changes[j].species] += (Population)m->changes[j].amount * m->count;
+	}
+	if( criticalMember ) {
+		for( size_t j = 0; j < criticalMember->changes.size(); j++ )
+			delta[criticalMember->changes[j].species] += criticalMember->changes[j].amount;
+	}
+
+	for( uint s = 0; s < n; s++ ) {
+		if( delta[s] < 0 && compartment->getPopulation( s ) + delta[s] < 0 )
+			return false;
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+void TauLeapGroup::applyCounts( double t ) throw() {
+	RNG::RNG *rng = getRNG();
+	DistributionContext *ctx = compartment->getSimulation()->distrCtx();
+	for( size_t i = 0; i < members.size(); i++ ) {
+		Member *m = members[i];
+		int k = m->count;
+		if( k == 0 )
+			continue;
+		m->count = 0;
+
+		for( Reactant *r = m->getTemplate()->getFirstReactant(); r; r = r->getNext() ) {
+			if( r->getConsumes() != 0 )
+				compartment->modifyPopulation( r->getIndex(), -(Population)r->getConsumes() * k );
+		}
+		for( Product *p = m->getTemplate()->getFirstProduct(); p; p = p->getNext() ) {
+			if( p->getTau()->isZero() ) {
+				compartment->modifyPopulation( p->getIndex(), (Population)p->getProduces() * k );
+				continue;
+			}
+			// Each firing happened at some uniformly distributed time in the
+			// leap. Delays that have already run out release right away.
+			for( int j = 0; j < k; j++ ) {
+				double release = leapStart + rng->rand_closed01() * (t - leapStart) + p->sampleTau( ctx );
+				compartment->getWaitList()->releaseAt( std::max( release, t ), p->getIndex(), p->getProduces() );
+			}
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+TauLeapGroup::Member *TauLeapGroup::choose( bool criticalOnly, double sum ) throw() {
+	// Linear search, as in the direct method
+	double r = getRNG()->rand_halfclosed01() * sum;
+	Member *chosen = NULL;
+	for( size_t i = 0; i < members.size(); i++ ) {
+		Member *m = members[i];
+		if( (criticalOnly && !m->critical) || !(m->a > 0.0) )
+			continue;
+		chosen = m;
+		r -= m->a;
+		if( r < 0.0 )
+			break;
+	}
+	return chosen;
+}
+
+} // namespace sgns2
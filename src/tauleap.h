@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2011, Jason Lloyd-Price, Abhishekh Gupta, and Andre S. Ribeiro
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of the contributors may not be used to endorse or promote
+	  products derived from this software without specific prior written
+	  permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/* tauleap.h/cpp
+
+TauLeapGroup class contents:
+	- ReactionGroup implementing adaptive explicit tau-leaping (Cao, Gillespie
+	  and Petzold, 2006)
+	- Chooses each leap so that no propensity is expected to change by more
+	  than a fraction epsilon, and fires the non-critical members a Poisson
+	  distributed number of times over the leap
+	- Simulates critical members (those within a few firings of exhausting a
+	  reactant, or whose propensities it cannot bound) exactly, and falls back
+	  to a run of exact direct method steps when a leap would be too short to
+	  be worth taking
+	- Commits the elapsed part of the leap by binomial thinning whenever a
+	  population is changed from outside the group
+*/
+
+#ifndef TAULEAP_H
+#define TAULEAP_H
+
+#include <vector>
+
+#include "reactiongroup.h"
+
+namespace sgns2 {
+
+// ===========================================================================
+class TauLeapGroup : public ReactionGroup {
+public:
+	explicit TauLeapGroup( Compartment *in ) throw();
+	virtual ~TauLeapGroup() throw();
+
+	// Manage the error control parameter of the step size selection
+	// Only affects leaps which are not yet planned
+	static inline double getEpsilon() throw() { return epsilon; }
+	static inline void setEpsilon( double eps ) throw() { epsilon = eps; }
+
+	// ReactionGroup interface
+	virtual GroupMember *newMember( const reaction::Template *tmplate );
+	virtual void removeMember( GroupMember *member ) throw();
+	virtual void touch( GroupMember *member ) throw();
+
+	// Ends the current leap, or fires one member in the exact mode
+	virtual void trigger() throw();
+	// Commits the elapsed part of the leap and plans a new one
+	virtual void update() throw();
+
+private:
+	// The slot of a Member is its position in the members list
+	class Member : public GroupMember {
+	public:
+		Member( TauLeapGroup *group, const reaction::Template *tmplate ) throw();
+		virtual ~Member() throw() {
+			getGroup()->removeMember( this );
+		}
+
+		double c; // The reaction's stochastic constant at instantiation
+		double a; // The member's current propensity
+		std::vector<Change> changes; // Non-zero net changes, delayed products excluded
+		int order; // Total order of the reaction (-1 if the propensity is not mass-action)
+		int count; // Number of firings in the planned leap
+		bool critical; // Is the member simulated exactly in the planned leap?
+		bool touched; // Set while the member is on the touched list
+	};
+
+	// Number of firings left before a member counts as critical
+	static const int CRITICAL_FIRINGS = 10;
+	// Leaps shorter than this many expected exact steps are not worth taking
+	static const int MIN_LEAP_STEPS = 10;
+	// Number of exact steps taken instead of a leap that is too short
+	static const int EXACT_STEPS = 100;
+	// Attempts at thinning a leap without a negative population
+	static const int THINNING_ATTEMPTS = 4;
+
+	// Recalculates the propensities of all touched members
+	void flushTouched() throw();
+	// Plans the next leap, or the next exact step, from time t
+	void plan( double t ) throw();
+	// Chooses the leap size of Cao, Gillespie and Petzold for the
+	// non-critical members, after sorting out the critical ones
+	double selectLeap() throw();
+	// Adds the changes of the members' counts to delta. Returns false if a
+	// population would become negative.
+	bool sumChanges() throw();
+	// Fires every member the number of times given by its count. The
+	// firings are spread uniformly over the leap from leapStart to t.
+	void applyCounts( double t ) throw();
+	// Chooses a member in proportion to its propensity, among the critical
+	// members only or among all of them
+	Member *choose( bool criticalOnly, double sum ) throw();
+
+	// Error control parameter: the largest relative change in a propensity
+	// expected over a leap
+	static double epsilon;
+
+	std::vector<Member*> members;
+	std::vector<Member*> touchedList; // Members touched since the last flush
+	// Scratch space by species: mean and variance of the change over a unit
+	// of time, highest order of reaction the species is a reactant in, and
+	// net change over the leap
+	std::vector<double> mu, sigma2, g;
+	std::vector<Population> delta;
+	std::vector<int> fullCounts; // Counts of the whole leap, while thinning
+	double leapStart; // Start of the planned leap
+	Member *criticalMember; // Critical member to fire at the end of the leap
+	uint exactSteps; // Exact steps left before trying to leap again
+	bool leaping; // Is the group's next event the end of a leap?
+};
+
+} // namespace sgns2
+
+#endif // TAULEAP_H
@@ -3,6 +3,7 @@
 
 #include "stdafx.h"
 
+#include <cmath>
 #include <new>
 
 #include "compartment.h"
@@ -10,38 +11,202 @@
 
 namespace sgns2 {
 
+double WaitList::binWidth = 0.0;
+
 // ---------------------------------------------------------------------------
 WaitList::WaitList( Compartment *in ) throw()
 : EventStream(in), EventQueue(), countAmount(0)
 {
+	setKind( KIND_WAITLIST );
 	newMin = &newMinHeap;
 }
 
 // ---------------------------------------------------------------------------
 WaitList::~WaitList() throw() {
+	for( size_t i = 0; i < lines.size(); i++ )
+		delete lines[i];
+	for( BinMap::iterator it = bins.begin(); it != bins.end(); ++it )
+		delete it->second;
+	for( size_t i = 0; i < spareBins.size(); i++ )
+		delete spareBins[i];
 }
 
 // ---------------------------------------------------------------------------
 void WaitList::releaseAt( double t, uint idx, Population amt ) {
 	// Add a new element at a specific given time
+	if( binWidth > 0.0 ) {
+		// Released at the end of the bin, up to binWidth late
+		countAmount = countAmount + amt;
+		int64 number = (int64)floor( t / binWidth );
+		BinMap::iterator it = bins.lower_bound( number );
+		if( it == bins.end() || it->first != number ) {
+			double end = (double)(number + 1) * binWidth;
+			Bin *bin;
+			if( spareBins.empty() ) {
+				bin = new Bin( this, end, number );
+			} else {
+				bin = spareBins.back();
+				spareBins.pop_back();
+				bin->number = number;
+				bin->head.requeue( end );
+			}
+			it = bins.insert( it, BinMap::value_type( number, bin ) );
+		}
+		it->second->add( idx, amt );
+		return;
+	}
+
 	ReleaseEvent *re = eventPool.alloc();
 	new( re ) ReleaseEvent( this, t, idx, amt );
 	countAmount = countAmount + amt;
 }
 
+// ---------------------------------------------------------------------------
+void WaitList::releaseAfter( double t, double delay, uint idx, Population amt ) {
+	// Molecules with the same delay are released in the order they were
+	// added, so they need only be queued one at a time
+
+	countAmount = countAmount + amt;
+	double when = t + delay;
+	size_t i;
+	for( i = 0; i < lines.size(); i++ ) {
+		DelayLine *line = lines[i];
+		if( line->delay != delay )
+			continue;
+		if( !line->head.isPending() ) {
+			line->head.idx = idx;
+			line->head.amt = amt;
+			line->head.requeue( when );
+		} else if( when >= line->lastTime ) {
+			line->push( when, idx, amt );
+		} else {
+			break; // Out of order, so it goes on the heap
+		}
+		line->lastTime = when;
+		return;
+	}
+	if( i == lines.size() && lines.size() < MAX_DELAY_LINES ) {
+		lines.push_back( new DelayLine( this, delay, when, idx, amt ) );
+		return;
+	}
+
+	ReleaseEvent *re = eventPool.alloc();
+	new( re ) ReleaseEvent( this, when, idx, amt );
+}
+
 // ---------------------------------------------------------------------------
 void WaitList::trigger() throw() {
 	// Release a product
 	ReleaseEvent *re = static_cast<ReleaseEvent*>(getNextEvent());
+	if( re->bin ) {
+		releaseBin( re->bin );
+		return;
+	}
 	static_cast<Compartment*>(getQueue())->modifyPopulation( re->idx, re->amt );
 	countAmount = countAmount - re->amt;
+	if( re->line ) {
+		re->line->pop();
+		return;
+	}
 	re->~ReleaseEvent(); // Dequeues the event
 	eventPool.free( re );
 }
 
+// ---------------------------------------------------------------------------
+void WaitList::releaseBin( Bin *bin ) {
+	bin->head.cancel();
+	bins.erase( bin->number );
+	Compartment *in = static_cast<Compartment*>(getQueue());
+	for( size_t i = 0; i < bin->releases.size(); i++ ) {
+		const Bin::Release &r = bin->releases[i];
+		in->modifyPopulation( r.idx, r.amt );
+		countAmount = countAmount - r.amt;
+	}
+	bin->releases.clear();
+	spareBins.push_back( bin );
+}
+
 // ---------------------------------------------------------------------------
 void WaitList::update() throw() {
 	// Update does nothing
 }
 
+// ---------------------------------------------------------------------------
+size_t WaitList::getMemoryUsage() const throw() {
+	// Map nodes are not counted, only the bins they point to
+	size_t bytes = sizeof( WaitList ) + getHeapMemory() + eventPool.getMemoryUsage()
+		+ lines.capacity() * sizeof( DelayLine* ) + spareBins.capacity() * sizeof( Bin* );
+	for( size_t i = 0; i < lines.size(); i++ )
+		bytes += lines[i]->getMemoryUsage();
+	for( BinMap::const_iterator it = bins.begin(); it != bins.end(); ++it )
+		bytes += sizeof( Bin ) + it->second->releases.capacity() * sizeof( Bin::Release );
+	for( size_t i = 0; i < spareBins.size(); i++ )
+		bytes += sizeof( Bin ) + spareBins[i]->releases.capacity() * sizeof( Bin::Release );
+	return bytes;
+}
+
+// ---------------------------------------------------------------------------
+WaitList::DelayLine::DelayLine( WaitList *wl, double delay, double time, uint index, Population amount )
+: delay(delay), lastTime(time), head( wl, time, index, amount, this )
+, ring(NULL), first(0), count(0), capacity(0)
+{
+}
+
+// ---------------------------------------------------------------------------
+WaitList::DelayLine::~DelayLine() {
+	delete[] ring;
+}
+
+// ---------------------------------------------------------------------------
+void WaitList::DelayLine::push( double time, uint index, Population amount ) {
+	if( count == capacity ) {
+		// Unwrap the ring into one twice the size
+		uint newCapacity = capacity ? capacity * 2 : 16;
+		Release *newRing = new Release[newCapacity];
+		for( uint i = 0; i < count; i++ )
+			newRing[i] = ring[(first + i) & (capacity - 1)];
+		delete[] ring;
+		ring = newRing;
+		first = 0;
+		capacity = newCapacity;
+	}
+	Release &r = ring[(first + count++) & (capacity - 1)];
+	r.time = time;
+	r.idx = index;
+	r.amt = amount;
+}
+
+// ---------------------------------------------------------------------------
+void WaitList::DelayLine::pop() {
+	if( !count ) {
+		head.cancel();
+		return;
+	}
+	const Release &r = ring[first];
+	head.idx = r.idx;
+	head.amt = r.amt;
+	head.requeue( r.time );
+	first = (first + 1) & (capacity - 1);
+	count--;
+}
+
+// ---------------------------------------------------------------------------
+size_t WaitList::DelayLine::getMemoryUsage() const throw() {
+	return sizeof( DelayLine ) + capacity * sizeof( Release );
+}
+
+// ---------------------------------------------------------------------------
+void WaitList::Bin::add( uint index, Population amount ) {
+	for( size_t i = 0; i < releases.size(); i++ ) {
+		if( releases[i].idx == index ) {
+			releases[i].amt = releases[i].amt + amount;
+			return;
+		}
+	}
+	Release r;
+	r.idx = index;
+	r.amt = amount;
+	releases.push_back( r );
+}
+
 } // namespace sgns2
@@ -29,11 +29,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 WaitList class contents:
 	- A specialization of EventQueue to store delayed molecules
+	- Releases molecules with the same constant delay from a FIFO, which
+	  takes a single place in the queue
+	- Optionally gathers the other releases into bins of a fixed width,
+	  each released at the end of its bin as a single event
+	- Reports the memory it holds
 */
 
 #ifndef WAITLIST_H
 #define WAITLIST_H
 
+#include <map>
+#include <vector>
+
 #include "mempool.h"
 #include "event.h"
 #include "simtypes.h"
@@ -49,29 +57,106 @@ public:
 
 	// Add a new element at a specific given time
 	void releaseAt( double t, uint idx, Population amt );
+	// Add a new element at a constant delay after the current time t, which
+	// must not decrease between calls
+	void releaseAfter( double t, double delay, uint idx, Population amt );
 	// Release a product
 	void trigger() throw();
 	// Update the queue
 	void update() throw();
 	// Returns the total number of molecules currently on the list
 	Population getSize() throw() { return countAmount; }
+	// Bytes held by the list, including the object itself
+	size_t getMemoryUsage() const throw();
+
+	// Width of the bins that releases at times which are not a constant
+	// delay away are delayed to the end of, or 0 to release them exactly
+	static inline double getBinWidth() throw() { return binWidth; }
+	static inline void setBinWidth( double width ) throw() { binWidth = width; }
 
 
 private:
+	class DelayLine;
+	class Bin;
 	class ReleaseEvent : public Event {
 	public:
-		ReleaseEvent( WaitList *wl, double time, uint index, Population amount )
-			: Event( wl ), idx(index), amt(amount) { enqueue( time ); }
+		ReleaseEvent( WaitList *wl, double time, uint index, Population amount, DelayLine *line = NULL, Bin *bin = NULL )
+			: Event( wl ), idx(index), amt(amount), line(line), bin(bin) { enqueue( time ); }
 		~ReleaseEvent() { }
 
+		inline void requeue( double time ) { enqueue( time ); }
+		inline void cancel() { dequeue(); }
+		inline bool isPending() const { return isInQueue(); }
+
 		uint idx;
 		Population amt;
+		DelayLine *line; // The line this release heads, or NULL
+		Bin *bin; // The bin this event releases, or NULL
 	};
 	MemoryPool<ReleaseEvent> eventPool;
 
+	// Releases with the same delay, in the order they were added. Only the
+	// first is in the queue.
+	class DelayLine {
+	public:
+		DelayLine( WaitList *wl, double delay, double time, uint index, Population amount );
+		~DelayLine();
+
+		// Adds a release after all the others
+		void push( double time, uint index, Population amount );
+		// Puts the next release at the head, or takes the head out of the
+		// queue if there is none
+		void pop();
+		// Bytes held by the line, including the object itself
+		size_t getMemoryUsage() const throw();
+
+		double delay;
+		double lastTime; // Time of the last release added
+		ReleaseEvent head;
+
+	private:
+		struct Release {
+			double time;
+			uint idx;
+			Population amt;
+		};
+		// Ring buffer of the releases after the head
+		Release *ring;
+		uint first, count, capacity;
+	};
+	// Lines are searched linearly, so there are only a few, and releases
+	// with other delays go on the heap
+	enum { MAX_DELAY_LINES = 8 };
+	std::vector< DelayLine* > lines;
+
+	// Total releases of each species due within a bin
+	class Bin {
+	public:
+		Bin( WaitList *wl, double time, int64 number )
+			: number(number), head( wl, time, 0, 0, NULL, this ) { }
+
+		// Adds a release of the species, merging it with any other
+		void add( uint index, Population amount );
+
+		struct Release {
+			uint idx;
+			Population amt;
+		};
+		std::vector< Release > releases;
+		int64 number; // The bin ends at (number + 1) * binWidth
+		ReleaseEvent head;
+	};
+	// Bins which have releases, by number, and emptied ones to reuse
+	typedef std::map< int64, Bin* > BinMap;
+	BinMap bins;
+	std::vector< Bin* > spareBins;
+	// Releases a bin's contents and puts it aside for reuse
+	void releaseBin( Bin *bin );
+	static double binWidth;
+
 	Population countAmount;
 	inline void newMinHeap_inl() {
-		enqueue( EventQueue::getNextEventTime() );
+		schedule( EventQueue::getNextEventTime() );
 	}
 	static void SGNS_FASTCALL newMinHeap( EventQueueBase *q ) {
 		static_cast<WaitList*>(q)->newMinHeap_inl();